@@ -0,0 +1,629 @@
+/**
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Implementation of batch.h
+ */
+#include <unistd.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <time.h>
+
+#include "batch.h"
+#include "list.h"
+#include "udp.h"
+#include "stream.h"
+
+Batcher *new_batcher(int batch_size, Time linger, int queue_limit) {
+    Batcher *b;
+
+    b = malloc(sizeof(Batcher));
+    b->batches = new_table();
+    b->batch_size = batch_size > 0 ? batch_size : 1;
+    b->linger = linger;
+    b->udp_fd = -1;
+    b->udp_mtu = 0;
+    b->queue_limit = queue_limit > 0 ? queue_limit : 1;
+    sem_init(&b->wake, 0, 0);
+    b->ready = new_queue(BATCH_READY_SIZE, &b->wake);
+    pthread_mutex_init(&b->mutex, NULL);
+
+    return b;
+}
+
+/**
+ * Checks whether a batch should be sent now. The batcher mutex must be held
+ *
+ * @param b Pointer to the batcher
+ * @param batch Pointer to the batch
+ * @param now Current time in milliseconds
+ * @return 1 if the batch is full or its oldest frame waited for the linger time, 0 otherwise
+ */
+int batcher_due(Batcher *b, PeerBatch *batch, Time now) {
+    return batch->count > 0 && (batch->count >= b->batch_size || batch->first_added + b->linger <= now);
+}
+
+int batcher_add(Batcher *b, char *peer_id, Peer *peer, int flags, SharedFrame *frame) {
+    return batcher_add_many(b, peer_id, peer, flags, &frame, 1);
+}
+
+int batcher_add_many(Batcher *b, char *peer_id, Peer *peer, int flags, SharedFrame **frames, int n) {
+    Buffer key, value, *lookup;
+    PeerBatch *batch;
+    PeerAddress *address;
+    Time now;
+    int lingering, i;
+
+    key.len = PEER_ID_SIZE;
+    key.data = peer_id;
+    now = now_milliseconds();
+
+    pthread_mutex_lock(&b->mutex);
+    lookup = table_search(b->batches, key);
+    if (lookup == NULL) { /* first frame ever sent to this neighbor, the batch is kept for the next ones */
+        batch = malloc(sizeof(PeerBatch));
+        memcpy(batch->peer_id, peer_id, PEER_ID_SIZE);
+        batch->frames = malloc(sizeof(Buffer *) * b->batch_size);
+        batch->count = 0;
+        batch->cap = b->batch_size;
+        batch->scheduled = 0;
+        batch->watchers = NULL;
+        batch->n_watchers = 0;
+        batch->streams = malloc(sizeof(OpenStreams));
+        batch->streams->open = new_table();
+        batch->streams->conn_id = 0;
+        value.len = sizeof(PeerBatch);
+        value.data = batch;
+        table_insert(b->batches, key, value);
+    } else {
+        batch = (PeerBatch *) lookup->data;
+    }
+
+    if (batch->count >= b->queue_limit && !(flags & BATCH_NO_DROP)) { /* the neighbor isn't keeping up, drop the newest rather than queue without bound */
+        pthread_mutex_unlock(&b->mutex);
+        for (i = 0; i < n; i++) {
+            frame_release(frames[i]);
+        }
+        peer_record_drop(peer);
+        return 1;
+    }
+
+    while (batch->count + n > batch->cap) { /* full but not sent yet, make room */
+        batch->cap *= 2;
+        batch->frames = realloc(batch->frames, sizeof(Buffer *) * batch->cap);
+    }
+    if (batch->count == 0) {
+        batch->first_added = now;
+        batch->udp = (flags & BATCH_UDP) != 0;
+    } else {
+        batch->udp = batch->udp && (flags & BATCH_UDP); /* a frame which must go over TCP takes the whole batch with it, so the frames stay in order */
+    }
+    batch->peer = peer;
+    address = peer_address(peer); /* the address may have changed since the last frame */
+    memcpy(&batch->addr, &address->addr, address->addr_len);
+    batch->addr_len = address->addr_len;
+    for (i = 0; i < n; i++) { /* in one go, so no frame added by another thread lands between them */
+        batch->frames[batch->count++] = &frames[i]->buff;
+    }
+
+    lingering = 0;
+    if (!batch->scheduled && batcher_due(b, batch, now)) {
+        batch->scheduled = 1;
+        queue_push(b->ready, batch); /* wakes up a sender */
+    } else if (!batch->scheduled && batch->count == n) {
+        lingering = 1;
+    }
+    pthread_mutex_unlock(&b->mutex);
+
+    if (lingering) { /* a sender has to time the linger of the batch */
+        sem_post(&b->wake);
+    }
+    return 0;
+}
+
+int batcher_backlogged(Batcher *b, char *peer_id, int wake_fd) {
+    Buffer key, *lookup;
+    PeerBatch *batch;
+    int backlogged, i;
+
+    key.len = PEER_ID_SIZE;
+    key.data = peer_id;
+
+    pthread_mutex_lock(&b->mutex);
+    lookup = table_search(b->batches, key);
+    batch = lookup != NULL ? (PeerBatch *) lookup->data : NULL;
+    backlogged = batch != NULL && batch->count > b->queue_limit;
+    if (backlogged) { /* registered under the same lock the senders drain the batch under, so the wake up can't be missed */
+        for (i = 0; i < batch->n_watchers && batch->watchers[i] != wake_fd; i++);
+        if (i == batch->n_watchers) {
+            batch->watchers = realloc(batch->watchers, sizeof(int) * (batch->n_watchers + 1));
+            batch->watchers[batch->n_watchers++] = wake_fd;
+        }
+    }
+    pthread_mutex_unlock(&b->mutex);
+
+    return backlogged;
+}
+
+/**
+ * Wakes up everyone waiting for a batch to get back within the queue limit. The batcher mutex must be held
+ *
+ * @param batch Pointer to the batch
+ */
+void batcher_notify(PeerBatch *batch) {
+    uint64_t one;
+    int i;
+
+    one = 1;
+    for (i = 0; i < batch->n_watchers; i++) {
+        if (write(batch->watchers[i], &one, sizeof(uint64_t)) < 0) {
+            perror("batcher notify failed");
+        }
+    }
+    batch->n_watchers = 0;
+}
+
+/**
+ * Moves the frames of a batch to a UDP neighbor which fit in a datagram to the end of its frames array, keeping the order of the frames
+ * within each part
+ *
+ * @param due Pointer to the batch
+ * @param mtu Largest frame sent as a datagram
+ * @return Number of frames at the start of the array which are too large for a datagram
+ */
+int batcher_split_udp(PeerBatch *due, Uint mtu) {
+    Buffer **sorted;
+    int i, n_tcp, n_udp;
+
+    n_tcp = 0;
+    for (i = 0; i < due->count; i++) {
+        n_tcp += due->frames[i]->len > mtu;
+    }
+    sorted = malloc(sizeof(Buffer *) * due->count);
+    n_udp = n_tcp;
+    n_tcp = 0;
+    for (i = 0; i < due->count; i++) {
+        if (due->frames[i]->len > mtu) {
+            sorted[n_tcp++] = due->frames[i];
+        } else {
+            sorted[n_udp++] = due->frames[i];
+        }
+    }
+    free(due->frames);
+    due->frames = sorted;
+
+    return n_tcp;
+}
+
+/**
+ * Sums the lengths of some of the frames of a batch
+ *
+ * @param due Pointer to the batch
+ * @param from Index of the first frame
+ * @param to Index after the last frame
+ * @return Total number of bytes
+ */
+unsigned long long batcher_bytes(PeerBatch *due, int from, int to) {
+    unsigned long long bytes;
+    int i;
+
+    bytes = 0;
+    for (i = from; i < to; i++) {
+        bytes += due->frames[i]->len;
+    }
+    return bytes;
+}
+
+/**
+ * Reads the frame that starts at a buffer of a batch. Every frame starts at the start of a buffer, and the stream id and the message header
+ * of a stream frame are in that first buffer. A chunk made by stream_split spans two buffers
+ *
+ * @param due Pointer to the batch
+ * @param i Index of the first buffer of the frame
+ * @param type Pointer to a char which is set to the type of the frame
+ * @param id Pointer to a stream id which is set to the stream of a stream frame
+ * @param content Pointer to a Uint which is set to the content length of the message of a FRAME_STREAM_BEGIN frame, and to the content
+ * bytes carried by a FRAME_STREAM_CHUNK frame
+ * @return Index of the first buffer of the next frame
+ */
+int batcher_read_frame(PeerBatch *due, int i, unsigned char *type, StreamId *id, Uint *content) {
+    FrameHeader hdr;
+    Message msg;
+    char *payload;
+    unsigned long long left;
+
+    frame_read_header((char *) due->frames[i]->data, due->frames[i]->len, (Uint) -1, &hdr); /* the frame was valid when it was queued */
+    payload = (char *) due->frames[i]->data + FRAME_HEADER_SIZE;
+    *type = hdr.type;
+    if (hdr.type == FRAME_STREAM_BEGIN || hdr.type == FRAME_STREAM_CHUNK || hdr.type == FRAME_STREAM_ABORT) {
+        stream_read_id(payload, hdr.len, id);
+    }
+    if (hdr.type == FRAME_STREAM_BEGIN) {
+        deserialize_msg_header(payload + STREAM_ID_SIZE, &msg);
+        *content = msg.content.len;
+    } else if (hdr.type == FRAME_STREAM_CHUNK) {
+        *content = hdr.len - STREAM_ID_SIZE;
+    }
+
+    left = FRAME_HEADER_SIZE + hdr.len;
+    do { /* the buffers of one frame add up to its length exactly */
+        left -= due->frames[i]->len;
+        i++;
+    } while (left > 0 && i < due->count);
+    return i;
+}
+
+/**
+ * Drops the frames of streams that can't go on from a batch about to be sent, the chunks and aborts of streams whose beginning wasn't sent
+ * to the neighbor before or in this batch. These are streams which were aborted, the receiver wouldn't know what to do with them
+ *
+ * @param due Pointer to the batch, its frames are compacted
+ * @return 1 if the batch holds frames of streams which began in an earlier batch, they must go over the connection those streams began on
+ */
+int batcher_check_streams(PeerBatch *due) {
+    StreamId id, *begun;
+    Buffer key;
+    unsigned char type;
+    Uint content;
+    int i, j, k, next, kept, keep, n_begun, continues;
+
+    begun = malloc(sizeof(StreamId) * due->count);
+    key.len = STREAM_ID_SIZE;
+    key.data = &id;
+    kept = n_begun = continues = 0;
+
+    for (i = 0; i < due->count; i = next) {
+        next = batcher_read_frame(due, i, &type, &id, &content);
+        keep = 1;
+        if (type == FRAME_STREAM_BEGIN) {
+            begun[n_begun++] = id;
+        } else if (type == FRAME_STREAM_CHUNK || type == FRAME_STREAM_ABORT) {
+            for (k = 0; k < n_begun && begun[k] != id; k++);
+            if (k == n_begun) {
+                keep = table_search(due->streams->open, key) != NULL;
+                continues = continues || keep;
+            }
+        }
+        for (j = i; j < next; j++) {
+            if (keep) {
+                due->frames[kept++] = due->frames[j];
+            } else {
+                frame_release((SharedFrame *) due->frames[j]); /* the buffer is the first member of the frame */
+            }
+        }
+    }
+    due->count = kept;
+    free(begun);
+
+    return continues;
+}
+
+/**
+ * Aborts every stream open on the connection to a neighbor, their remaining frames are dropped by batcher_check_streams
+ *
+ * @param due Pointer to the batch
+ */
+void batcher_abort_streams(PeerBatch *due) {
+    if (due->streams->open->size == 0) {
+        return;
+    }
+    printf("aborting %u streams to %.*s, the connection they were sent on is gone\n", due->streams->open->size, PEER_ID_SIZE, due->peer_id);
+    free_table(due->streams->open);
+    due->streams->open = new_table();
+}
+
+/**
+ * Records which streams are open on the connection to a neighbor once a batch was sent. A send that failed, or went over another connection
+ * than the open streams began on, aborts them
+ *
+ * @param due Pointer to the batch
+ * @param send Pointer to the send of the batch
+ */
+void batcher_track_streams(PeerBatch *due, PoolSend *send) {
+    StreamId id;
+    Buffer key, value, *lookup;
+    unsigned char type;
+    Uint content;
+    int i;
+
+    if (send->err || send->conn_id != due->streams->conn_id) {
+        batcher_abort_streams(due);
+    }
+    if (send->err) {
+        return;
+    }
+    due->streams->conn_id = send->conn_id;
+
+    key.len = STREAM_ID_SIZE;
+    key.data = &id;
+    for (i = 0; i < send->count;) {
+        i = batcher_read_frame(due, i, &type, &id, &content);
+        lookup = table_search(due->streams->open, key);
+        if (type == FRAME_STREAM_BEGIN && content > 0) {
+            value.len = content;
+            value.data = NULL;
+            table_insert(due->streams->open, key, value);
+        } else if (type == FRAME_STREAM_CHUNK && lookup != NULL && lookup->len > content) {
+            lookup->len -= content;
+        } else if ((type == FRAME_STREAM_CHUNK || type == FRAME_STREAM_ABORT) && lookup != NULL) { /* the last chunk, or the stream was aborted */
+            table_delete(due->streams->open, key);
+        }
+    }
+}
+
+/**
+ * Sends the frames of the due batches. Frames to UDP neighbors that fit in a datagram all go out together with sendmmsg, everything else goes
+ * over the pooled TCP connections with one vectored write per neighbor. A batch holding chunks of open streams must go over the connection
+ * they began on, if that connection is gone before any of the batch was written the streams are aborted and the rest of the batch is sent
+ * over a new connection. The outcome is recorded on the peer table entry of every neighbor
+ *
+ * @param b Pointer to the batcher
+ * @param pool Pointer to the connection pool
+ * @param due_batches List of the due batches
+ */
+void batcher_send(Batcher *b, ConnPool *pool, List *due_batches) {
+    ListNode *node;
+    PeerBatch *due;
+    PoolSend *sends, *retries;
+    PeerBatch **owners;
+    UdpSend *udp_sends;
+    int *retried, i, n, n_udp, n_tcp, n_retry, udp_frames, pinned;
+
+    udp_frames = 0;
+    for (node = due_batches->bottom; node != NULL; node = node->prev) {
+        due = (PeerBatch *) node->value;
+        udp_frames += due->udp ? due->count : 0;
+    }
+    sends = malloc(sizeof(PoolSend) * due_batches->size);
+    owners = malloc(sizeof(PeerBatch *) * due_batches->size);
+    udp_sends = malloc(sizeof(UdpSend) * (udp_frames > 0 ? udp_frames : 1));
+    n = n_udp = 0;
+
+    for (node = due_batches->bottom; node != NULL; node = node->prev) {
+        due = (PeerBatch *) node->value;
+        pinned = !due->udp && batcher_check_streams(due); /* stream frames are never sent over UDP */
+        n_tcp = due->count;
+        if (due->udp && b->udp_fd >= 0 && due->addr.ss_family == AF_INET) { /* the UDP socket is IPv4, IPv6 neighbors are sent to over TCP */
+            n_tcp = batcher_split_udp(due, b->udp_mtu); /* frames too large for a datagram still go over TCP */
+            for (i = n_tcp; i < due->count; i++) {
+                memcpy(&udp_sends[n_udp].to, &due->addr, sizeof(struct sockaddr_in));
+                udp_sends[n_udp].frame = due->frames[i];
+                n_udp++;
+            }
+            if (n_tcp < due->count) { /* datagrams are never reported lost */
+                peer_record_send(due->peer, due->count - n_tcp, batcher_bytes(due, n_tcp, due->count), 0);
+            }
+        }
+        if (n_tcp > 0) { /* all the frames to one neighbor go in one write */
+            sends[n].peer_id = due->peer_id;
+            sends[n].addr = (struct sockaddr *) &due->addr;
+            sends[n].addr_len = due->addr_len;
+            sends[n].buffs = due->frames;
+            sends[n].count = n_tcp;
+            sends[n].pin = pinned ? due->streams->conn_id : 0;
+            owners[n] = due;
+            n++;
+        }
+    }
+
+    if (n_udp > 0) {
+        udp_send_all(b->udp_fd, udp_sends, n_udp);
+    }
+    if (n > 0) {
+        pool_sendv_all(pool, sends, n);
+    }
+
+    retries = malloc(sizeof(PoolSend) * (n > 0 ? n : 1));
+    retried = malloc(sizeof(int) * (n > 0 ? n : 1));
+    n_retry = 0;
+    for (i = 0; i < n; i++) {
+        if (sends[i].err && sends[i].pin != 0 && sends[i].written == 0) { /* the connection of the open streams is gone, the rest can go on a new one */
+            batcher_abort_streams(owners[i]);
+            batcher_check_streams(owners[i]);
+            sends[i].count = owners[i]->count; /* never split for UDP, the batch holds stream frames */
+            sends[i].pin = 0;
+            if (sends[i].count > 0) {
+                retries[n_retry] = sends[i];
+                retried[n_retry++] = i;
+            }
+        }
+    }
+    if (n_retry > 0) {
+        pool_sendv_all(pool, retries, n_retry);
+        for (i = 0; i < n_retry; i++) {
+            sends[retried[i]] = retries[i];
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        batcher_track_streams(owners[i], &sends[i]);
+        peer_record_send(owners[i]->peer, sends[i].count, batcher_bytes(owners[i], 0, sends[i].count), sends[i].err);
+    }
+    free(retries);
+    free(retried);
+    free(udp_sends);
+    free(sends);
+    free(owners);
+}
+
+/**
+ * Takes the frames out of a batch so they can be sent without holding the batcher mutex, which must be held
+ *
+ * @param b Pointer to the batcher
+ * @param batch Pointer to the batch
+ * @return Pointer to a new batch holding the frames taken
+ */
+PeerBatch *batcher_take(Batcher *b, PeerBatch *batch) {
+    PeerBatch *due;
+
+    due = malloc(sizeof(PeerBatch));
+    memcpy(due, batch, sizeof(PeerBatch));
+    batch->frames = malloc(sizeof(Buffer *) * b->batch_size);
+    batch->count = 0;
+    batch->cap = b->batch_size;
+
+    return due;
+}
+
+/**
+ * Finishes the batches that were sent, releases their frames and hands the batches which got more frames meanwhile back to the senders
+ *
+ * @param b Pointer to the batcher
+ * @param due_batches List of the batches that were sent, emptied
+ */
+void batcher_done(Batcher *b, List *due_batches) {
+    PeerBatch *batch, *due;
+    Buffer key;
+    Time now;
+    int i;
+
+    now = now_milliseconds();
+    pthread_mutex_lock(&b->mutex);
+    while ((due = (PeerBatch *) list_poplast(due_batches)) != NULL) {
+        key.len = PEER_ID_SIZE;
+        key.data = due->peer_id;
+        batch = (PeerBatch *) table_search(b->batches, key)->data;
+        if (batcher_due(b, batch, now)) { /* frames were added while we were sending, they go next */
+            queue_push(b->ready, batch);
+        } else {
+            batch->scheduled = 0;
+        }
+        if (batch->n_watchers > 0 && batch->count <= b->queue_limit) {
+            batcher_notify(batch);
+        }
+
+        for (i = 0; i < due->count; i++) {
+            frame_release((SharedFrame *) due->frames[i]); /* the buffer is the first member of the frame */
+        }
+        free(due->frames);
+        free(due);
+    }
+    pthread_mutex_unlock(&b->mutex);
+}
+
+/**
+ * Hands the batches whose linger time ran out to the senders
+ *
+ * @param b Pointer to the batcher
+ * @return Milliseconds until the next lingering batch is due, or -1 if no batch is lingering
+ */
+Time batcher_schedule_due(Batcher *b) {
+    TableIter *it;
+    PeerBatch *batch;
+    Time now, wait, next_due;
+
+    now = now_milliseconds();
+    next_due = -1;
+
+    pthread_mutex_lock(&b->mutex);
+    it = table_iter_new(b->batches);
+    while (table_iter_next(it)) {
+        batch = (PeerBatch *) it->curr->value.data;
+        if (batch->count == 0 || batch->scheduled) {
+            continue;
+        }
+        if (batcher_due(b, batch, now)) {
+            batch->scheduled = 1;
+            queue_push(b->ready, batch);
+        } else {
+            wait = batch->first_added + b->linger - now;
+            if (next_due < 0 || wait < next_due) {
+                next_due = wait;
+            }
+        }
+    }
+    free(it);
+    pthread_mutex_unlock(&b->mutex);
+
+    return next_due;
+}
+
+Time batcher_flush(Batcher *b, ConnPool *pool, int force) {
+    TableIter *it;
+    PeerBatch *batch;
+    List *due_batches;
+    Time now, wait, next_due;
+
+    now = now_milliseconds();
+    next_due = -1;
+    due_batches = new_list();
+
+    /* take the due batches out under the lock and send them after releasing it, so other threads can keep adding frames meanwhile */
+    pthread_mutex_lock(&b->mutex);
+    it = table_iter_new(b->batches);
+    while (table_iter_next(it)) {
+        batch = (PeerBatch *) it->curr->value.data;
+        if (batch->count == 0 || batch->scheduled) { /* the sender that has the batch sends these frames after what it holds */
+            continue;
+        }
+        wait = batch->first_added + b->linger - now;
+        if (force || wait <= 0 || batch->count >= b->batch_size) {
+            batch->scheduled = 1;
+            list_push(due_batches, batcher_take(b, batch));
+
+        } else if (next_due < 0 || wait < next_due) {
+            next_due = wait;
+        }
+    }
+    free(it);
+    pthread_mutex_unlock(&b->mutex);
+
+    if (due_batches->size > 0) {
+        batcher_send(b, pool, due_batches);
+        batcher_done(b, due_batches);
+    }
+    free_list(due_batches);
+
+    return next_due;
+}
+
+void batcher_run(Batcher *b, ConnPool *pool) {
+    PeerBatch *batch;
+    List *due_batches;
+    Time wait;
+    struct timespec deadline;
+
+    while (1) {
+        wait = b->linger > 0 ? batcher_schedule_due(b) : -1;
+        if (wait < 0) {
+            sem_wait(&b->wake);
+        } else {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += wait / 1000;
+            deadline.tv_nsec += (wait % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            sem_timedwait(&b->wake, &deadline);
+        }
+
+        /* neighbors that are up are sent to side by side, one that is down or was never sent to might hold up the others until the
+         * connect timeout, so it is sent to on its own */
+        due_batches = new_list();
+        pthread_mutex_lock(&b->mutex);
+        while ((batch = (PeerBatch *) queue_pop(b->ready)) != NULL) {
+            if (__atomic_load_n(&batch->peer->state, __ATOMIC_RELAXED) != PEER_STATE_UP) {
+                if (due_batches->size > 0) {
+                    queue_push(b->ready, batch); /* left to the next sender */
+                } else {
+                    list_push(due_batches, batcher_take(b, batch));
+                }
+                break;
+            }
+            list_push(due_batches, batcher_take(b, batch));
+        }
+        pthread_mutex_unlock(&b->mutex);
+
+        if (due_batches->size > 0) {
+            batcher_send(b, pool, due_batches);
+            batcher_done(b, due_batches);
+        }
+        free_list(due_batches);
+    }
+}
+
+void batcher_enable_udp(Batcher *b, int udp_fd, Uint mtu) {
+    b->udp_fd = udp_fd;
+    b->udp_mtu = mtu;
+}
@@ -0,0 +1,154 @@
+/**
+ * Outbox batching
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Collects framed messages that are on their way out by the neighbor they are sent to (the next hop), so all the messages pending for one
+ * neighbor go out together in a single vectored write. A batch is sent once it holds batch_size messages or once its oldest message has
+ * waited for the linger time.
+ *
+ * The batch of a neighbor is its outbound queue, it holds at most queue_limit messages and messages beyond that are dropped. Batches that
+ * are due wait in a ready queue for the sender threads, so a slow neighbor only holds up the messages to itself. Batches to neighbors that
+ * are up are sent side by side, a neighbor that is down is always sent to on its own.
+ *
+ * The chunks of a stream only make sense on the connection its beginning went over, the receiver keeps streams per connection. The batcher
+ * remembers which streams are open on the connection to every neighbor and sends their chunks over that connection only. When that
+ * connection is lost, the streams on it are aborted: their remaining frames are dropped, and the receiver aborts them as the connection closes
+ */
+
+#ifndef DISTMSG_BATCH_H
+#define DISTMSG_BATCH_H
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "util.h"
+#include "table.h"
+#include "pool.h"
+#include "frame.h"
+#include "peer.h"
+#include "queue.h"
+
+/**
+ * Flags of a frame added to a batch
+ */
+#define BATCH_UDP 1 /* send the frame as a datagram if it is small enough, otherwise it always goes over TCP */
+#define BATCH_NO_DROP 2 /* the frame is part of a stream, it is queued even if the queue of the neighbor is full */
+
+#define BATCH_READY_SIZE 1024 /* batches the ready queue holds without allocating */
+
+/**
+ * Holds the streams whose beginning was sent to a neighbor and which didn't end yet
+ */
+typedef struct {
+    Table *open; /* stream id -> the len of the value is the number of content bytes of the stream still to be sent */
+    unsigned long long conn_id; /* id of the pooled connection the open streams began on */
+} OpenStreams;
+/**
+ * Holds the frames waiting to be sent to a single neighbor
+ */
+typedef struct {
+    char peer_id[PEER_ID_SIZE];
+    Peer *peer; /* entry of the neighbor in the peer table, its counters are updated after every send */
+    struct sockaddr_storage addr; /* address of the neighbor */
+    socklen_t addr_len; /* length of addr in bytes */
+    int udp; /* 1 if frames that fit in a datagram are sent to the neighbor over UDP, 0 once any frame in the batch must go over TCP */
+    Buffer **frames; /* array of pointers to the buffers of the shared frames, in the order they were added */
+    int count; /* number of frames in the batch */
+    int cap; /* number of pointers allocated for frames, more than batch_size only if frames were added faster than they were flushed */
+    Time first_added; /* time in milliseconds the oldest frame in the batch was added */
+    int scheduled; /* 1 while the batch waits in the ready queue or a sender sends frames taken from it, frames added meanwhile go next */
+    int *watchers; /* eventfds written to once the batch is back within queue_limit frames, see batcher_backlogged */
+    int n_watchers; /* number of eventfds in watchers */
+    OpenStreams *streams; /* shared with the batches taken out for sending, only the sender holding the batch reads or changes it */
+} PeerBatch;
+/**
+ * Holds the batches of all the neighbors
+ */
+typedef struct {
+    Table *batches; /* peer id -> PeerBatch */
+    int batch_size; /* most frames sent in one batch */
+    Time linger; /* milliseconds a frame may wait for more frames to the same neighbor before it is sent */
+    int udp_fd; /* UDP socket datagrams are sent from, -1 if UDP is not used */
+    Uint udp_mtu; /* largest frame sent as a datagram */
+    int queue_limit; /* most frames waiting in one batch, more are dropped */
+    Queue *ready; /* batches that are due and not being sent, each one at most once */
+    sem_t wake; /* posted when a batch becomes ready or a linger time starts, the senders wait on it */
+    pthread_mutex_t mutex;
+} Batcher;
+
+/**
+ * Creates a new batcher with no pending frames
+ *
+ * @param batch_size Most frames sent in one batch
+ * @param linger Milliseconds a frame may wait for more frames to the same neighbor before it is sent
+ * @param queue_limit Most frames waiting to be sent to one neighbor
+ * @return Pointer to the new batcher
+ */
+Batcher *new_batcher(int batch_size, Time linger, int queue_limit);
+/**
+ * Adds a framed message to the batch of the neighbor it is sent to, the batcher takes over the caller's reference to the frame and releases it
+ * once the frame is sent or dropped. The batch is handed to the senders once it is due. The address of the neighbor is copied into the
+ * batch, so the caller must be reading the peer directory
+ *
+ * @param b Pointer to the batcher
+ * @param peer_id Id of the neighbor, PEER_ID_SIZE bytes
+ * @param peer Pointer to the entry of the neighbor in the peer table
+ * @param flags BATCH_* flags of the frame
+ * @param frame Pointer to the framed message
+ * @return 1 if the frame was dropped because the batch of the neighbor is full, 0 otherwise
+ */
+int batcher_add(Batcher *b, char *peer_id, Peer *peer, int flags, SharedFrame *frame);
+/**
+ * Adds several framed messages to the batch of the neighbor they are sent to, one right after the other with no frame added by another
+ * thread between them, otherwise behaves like batcher_add. The frames of a stream are added together since the receiver reads a chunk
+ * header and the bytes that follow it as one frame
+ *
+ * @param b Pointer to the batcher
+ * @param peer_id Id of the neighbor, PEER_ID_SIZE bytes
+ * @param peer Pointer to the entry of the neighbor in the peer table
+ * @param flags BATCH_* flags of all the frames
+ * @param frames Array of pointers to the framed messages, in order
+ * @param n Number of frames
+ * @return 1 if the frames were all dropped because the batch of the neighbor is full, 0 otherwise
+ */
+int batcher_add_many(Batcher *b, char *peer_id, Peer *peer, int flags, SharedFrame **frames, int n);
+/**
+ * Checks whether more frames wait to be sent to a neighbor than its queue holds, which only happens with the frames of streams. If so
+ * the eventfd given is written to once the neighbor caught up, so a listener relaying a stream can stop reading the connection the
+ * stream comes in on without blocking
+ *
+ * @param b Pointer to the batcher
+ * @param peer_id Id of the neighbor, PEER_ID_SIZE bytes
+ * @param wake_fd eventfd to write to once no more than queue_limit frames wait to be sent to the neighbor
+ * @return 1 if the neighbor is backed up and wake_fd will be written to, 0 otherwise
+ */
+int batcher_backlogged(Batcher *b, char *peer_id, int wake_fd);
+/**
+ * Runs a sender, sends the batches as they become due and never returns. Any number of threads may run senders on the same batcher
+ *
+ * @param b Pointer to the batcher
+ * @param pool Pointer to the connection pool to send over
+ */
+void batcher_run(Batcher *b, ConnPool *pool);
+/**
+ * Sends every batch that is full or has waited for the linger time, or every non-empty batch if force is set, from the calling thread.
+ * Batches that are scheduled for the senders are left to them
+ *
+ * @param b Pointer to the batcher
+ * @param pool Pointer to the connection pool to send over
+ * @param force 1 to send all pending frames regardless of the linger time
+ * @return Milliseconds until the next pending batch is due, or -1 if no frames are pending
+ */
+Time batcher_flush(Batcher *b, ConnPool *pool, int force);
+
+/**
+ * Lets the batcher send frames to UDP neighbors as datagrams
+ *
+ * @param b Pointer to the batcher
+ * @param udp_fd UDP socket to send from
+ * @param mtu Largest frame sent as a datagram, larger frames go over TCP
+ */
+void batcher_enable_udp(Batcher *b, int udp_fd, Uint mtu);
+
+#endif //DISTMSG_BATCH_H
@@ -0,0 +1,99 @@
+/**
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Implementation of bloom.h
+ */
+#include "bloom.h"
+
+#include <math.h>
+
+unsigned long long bloom_bytes(Uint capacity, double fp_rate) {
+    double bits;
+    unsigned long long blocks;
+
+    if (fp_rate <= 0 || fp_rate >= 1) {
+        fp_rate = 0.01;
+    }
+    bits = -(double) capacity * log(fp_rate) / (M_LN2 * M_LN2); /* the optimal number of bits for capacity hashes at fp_rate */
+    blocks = (unsigned long long) ceil(bits / BLOOM_BLOCK_BITS);
+
+    return (blocks > 0 ? blocks : 1) * BLOOM_BLOCK_WORDS * sizeof(unsigned long long);
+}
+
+BloomFilter *new_bloom(Uint capacity, unsigned long long bytes) {
+    BloomFilter *f;
+    unsigned long long blocks;
+    int probes;
+
+    blocks = bytes / (BLOOM_BLOCK_WORDS * sizeof(unsigned long long));
+    if (blocks < 1) {
+        blocks = 1;
+    }
+    probes = (int) lround((double) (blocks * BLOOM_BLOCK_BITS) / (capacity > 0 ? capacity : 1) * M_LN2); /* the optimal number for the bits the filter got */
+    if (probes < 1) {
+        probes = 1;
+    } else if (probes > BLOOM_MAX_PROBES) {
+        probes = BLOOM_MAX_PROBES;
+    }
+
+    f = malloc(sizeof(BloomFilter));
+    f->words = aligned_alloc(BLOOM_BLOCK_WORDS * sizeof(unsigned long long), blocks * BLOOM_BLOCK_WORDS * sizeof(unsigned long long)); /* blocks start on a cache line */
+    f->blocks = (Uint) blocks;
+    f->probes = probes;
+    bloom_clear(f);
+
+    return f;
+}
+
+void free_bloom(BloomFilter *f) {
+    free(f->words);
+    free(f);
+}
+
+void bloom_clear(BloomFilter *f) {
+    memset(f->words, 0, (size_t) f->blocks * BLOOM_BLOCK_WORDS * sizeof(unsigned long long));
+}
+
+/**
+ * Finds the block of a hash and the two values its bits are derived from
+ *
+ * @param f Pointer to the filter
+ * @param hash 64 bit hash of the item
+ * @param step Pointer to an int which is set to the distance between consecutive bits of the hash within the block, always odd
+ * @return Pointer to the first word of the block, the first bit of the hash is hash modulo BLOOM_BLOCK_BITS
+ */
+unsigned long long *bloom_block(BloomFilter *f, unsigned long long hash, Uint *step) {
+    *step = (Uint) (hash >> 9) | 1; /* odd so the bits of a hash are all different, at least as long as there are fewer of them than bits in a block */
+    return &f->words[(((hash >> 32) * f->blocks) >> 32) * BLOOM_BLOCK_WORDS]; /* the high bits scaled to the number of blocks, no division */
+}
+
+void bloom_add(BloomFilter *f, unsigned long long hash) {
+    unsigned long long *block;
+    Uint step, bit;
+    int i;
+
+    block = bloom_block(f, hash, &step);
+    bit = (Uint) hash;
+    for (i = 0; i < f->probes; i++) {
+        block[(bit % BLOOM_BLOCK_BITS) / 64] |= 1ULL << (bit % 64);
+        bit += step;
+    }
+}
+
+int bloom_test(BloomFilter *f, unsigned long long hash) {
+    unsigned long long *block;
+    Uint step, bit;
+    int i;
+
+    block = bloom_block(f, hash, &step);
+    bit = (Uint) hash;
+    for (i = 0; i < f->probes; i++) {
+        if ((block[(bit % BLOOM_BLOCK_BITS) / 64] & (1ULL << (bit % 64))) == 0) {
+            return 0;
+        }
+        bit += step;
+    }
+
+    return 1;
+}
@@ -0,0 +1,74 @@
+/**
+ * Bloom filter
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * A compact set of hashes that answers whether a hash was added with no false negatives and a tunable rate of false positives. The bits
+ * are split into blocks of one cache line and all the bits of a hash fall in the same block, so testing or adding a hash touches a single
+ * cache line however large the filter is. Keeping every bit of a hash in one block makes false positives slightly more likely than the
+ * rate the filter was sized for
+ */
+
+#ifndef DISTMSG_BLOOM_H
+#define DISTMSG_BLOOM_H
+
+#include "util.h"
+
+#define BLOOM_BLOCK_WORDS 8 /* 64 bit words in a block, a block is one cache line */
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)
+#define BLOOM_MAX_PROBES 16 /* most bits set for a hash, more cost time and barely lower the rate within a block */
+
+/**
+ * Holds the entire filter
+ */
+typedef struct {
+    unsigned long long *words; /* the bits, blocks * BLOOM_BLOCK_WORDS words */
+    Uint blocks;
+    int probes; /* bits set for every hash */
+} BloomFilter;
+
+/**
+ * Calculates the number of bytes a filter needs to hold a number of hashes at a rate of false positives
+ *
+ * @param capacity Number of hashes the filter is expected to hold
+ * @param fp_rate Rate of false positives wanted once the filter holds capacity hashes, between 0 and 1
+ * @return Number of bytes, a whole number of blocks
+ */
+unsigned long long bloom_bytes(Uint capacity, double fp_rate);
+/**
+ * Creates a new empty filter
+ *
+ * @param capacity Number of hashes the filter is expected to hold, used to choose the number of bits set for every hash
+ * @param bytes Size of the filter in bytes, rounded down to a whole number of blocks and at least one block
+ * @return Pointer to the new filter
+ */
+BloomFilter *new_bloom(Uint capacity, unsigned long long bytes);
+/**
+ * Frees a given filter
+ *
+ * @param f Pointer to the filter
+ */
+void free_bloom(BloomFilter *f);
+/**
+ * Removes every hash from the filter
+ *
+ * @param f Pointer to the filter
+ */
+void bloom_clear(BloomFilter *f);
+/**
+ * Adds a hash to the filter
+ *
+ * @param f Pointer to the filter
+ * @param hash 64 bit hash of the item, every bit of it must depend on the item
+ */
+void bloom_add(BloomFilter *f, unsigned long long hash);
+/**
+ * Checks whether a hash may have been added to the filter
+ *
+ * @param f Pointer to the filter
+ * @param hash 64 bit hash of the item
+ * @return 0 if the hash was surely never added since the filter was created or cleared, 1 if it may have been
+ */
+int bloom_test(BloomFilter *f, unsigned long long hash);
+
+#endif //DISTMSG_BLOOM_H
@@ -22,6 +22,8 @@
 #define CMD_DISCOVER 1 /* MUST BE SYNCHRONIZED WITH main.c */
 #define CMD_SEND 2 /* MUST BE SYNCHRONIZED WITH main.c */
 #define CMD_CONNECT 3 /* MUST BE SYNCHRONIZED WITH main.c */
+#define CMD_SUBSCRIBE 5 /* MUST BE SYNCHRONIZED WITH main.c */
+#define CMD_UNSUBSCRIBE 6 /* MUST BE SYNCHRONIZED WITH main.c */
 
 typedef long long Time; /* MUST BE SYNCHRONIZED WITH main.c */
 /**
@@ -138,6 +140,12 @@ Command parse_command(char *input, int input_len, int *error) {
         cmd.content_len = 0;
         cmd.content = NULL;
         return cmd;
+    }else if (strncmp(input, "subscribe", 9) == 0 || strncmp(input, "unsubscribe", 11) == 0) {
+        cmd.cmd = input[0] == 's' ? CMD_SUBSCRIBE : CMD_UNSUBSCRIBE;
+        memset(cmd.peer_id, 0, PEER_ID_SIZE);
+        cmd.content_len = 0;
+        cmd.content = NULL;
+        return cmd;
     }else if (strncmp(input, "connect", 7) == 0) {
         cmd.cmd = CMD_CONNECT;
         i += 7;
@@ -2,6 +2,10 @@
 // Created by amit on 10/19/23.
 //
 #include "config.h"
+#include "stream.h"
+#include "udp.h"
+
+#include <unistd.h>
 
 int load_config(Config *conf,char *file_path) {
     FILE *fp;
@@ -9,7 +13,36 @@ int load_config(Config *conf,char *file_path) {
     short peer_table_mode, has_interface;
     ssize_t len, line_len, i, num_keys;
 
-    (*conf).peer_table = new_table();
+    (*conf).peer_table = new_peer_directory();
+    (*conf).listen_backlog = SOMAXCONN; /* optional keys get their defaults before the file is read */
+    (*conf).pool_idle_timeout = 60;
+    (*conf).connect_timeout = 1000;
+    (*conf).fanout_limit = 64;
+    (*conf).max_frame_size = 64 * 1024 * 1024;
+    (*conf).batch_size = 64;
+    (*conf).batch_linger = 0;
+    (*conf).io_backend = IO_BACKEND_EPOLL;
+    (*conf).transport = TRANSPORT_TCP;
+    (*conf).udp_mtu = 1400;
+    (*conf).interface_queue_limit = 4096;
+    (*conf).stream_threshold = 1024 * 1024;
+    (*conf).stream_chunk_size = 64 * 1024;
+    (*conf).stream_buffer_limit = 256LL * 1024 * 1024;
+    (*conf).workers = (int) sysconf(_SC_NPROCESSORS_ONLN); /* one per core */
+    if ((*conf).workers < 1) {
+        (*conf).workers = 1;
+    }
+    (*conf).listeners = 1;
+    (*conf).pin_listeners = 0;
+    (*conf).dispatch_budget = 64;
+    (*conf).dedup_shards = 64;
+    (*conf).dedup_window = 60;
+    (*conf).dedup_max_origins = 65536;
+    (*conf).dedup_filter_fp_rate = 0.01;
+    (*conf).dedup_filter_memory = 4194304;
+    (*conf).dedup_seq_window = 4096;
+    (*conf).senders = 8;
+    (*conf).peer_queue_limit = 4096;
 
     num_keys = len = 0;
     peer_table_mode = has_interface = 0;
@@ -37,8 +70,11 @@ int load_config(Config *conf,char *file_path) {
 
             if (peer_table_mode == 1) {
                 //printf("INSERT PEER TABLE %s %s\n", key, val);
-                table_insert((*conf).peer_table,
-                             buffer_from_str(key, 0), buffer_from_str(val, -1));
+                directory_write_begin((*conf).peer_table);
+                if (directory_insert((*conf).peer_table, buffer_from_str(key, 0), val, strlen(val))) {
+                    printf("IGNORING PEER %s WITH INVALID ADDRESS \"%s\"\n", key, val);
+                }
+                directory_write_end((*conf).peer_table);
 
             }else {
 
@@ -59,6 +95,84 @@ int load_config(Config *conf,char *file_path) {
                     (*conf).interface_port = atoi(val);
                     has_interface = 1;
 
+                } else if (strcmp(key, "listen_backlog") == 0) {
+                    (*conf).listen_backlog = atoi(val);
+
+                } else if (strcmp(key, "pool_idle_timeout") == 0) {
+                    (*conf).pool_idle_timeout = atoi(val);
+
+                } else if (strcmp(key, "connect_timeout") == 0) {
+                    (*conf).connect_timeout = atoi(val);
+
+                } else if (strcmp(key, "fanout_limit") == 0) {
+                    (*conf).fanout_limit = atoi(val);
+
+                } else if (strcmp(key, "max_frame_size") == 0) {
+                    (*conf).max_frame_size = strtoul(val, NULL, 10);
+
+                } else if (strcmp(key, "batch_size") == 0) {
+                    (*conf).batch_size = atoi(val);
+
+                } else if (strcmp(key, "batch_linger") == 0) {
+                    (*conf).batch_linger = atoi(val);
+
+                } else if (strcmp(key, "io_backend") == 0) {
+                    (*conf).io_backend = strcmp(val, "uring") == 0 ? IO_BACKEND_URING : IO_BACKEND_EPOLL;
+
+                } else if (strcmp(key, "transport") == 0) {
+                    (*conf).transport = strcmp(val, "udp") == 0 ? TRANSPORT_UDP : TRANSPORT_TCP;
+
+                } else if (strcmp(key, "udp_mtu") == 0) {
+                    (*conf).udp_mtu = strtoul(val, NULL, 10); /* checked once every key is read */
+
+                } else if (strcmp(key, "interface_queue_limit") == 0) {
+                    (*conf).interface_queue_limit = atoi(val) > 0 ? atoi(val) : 1;
+
+                } else if (strcmp(key, "stream_threshold") == 0) {
+                    (*conf).stream_threshold = strtoul(val, NULL, 10); /* checked once every key is read */
+
+                } else if (strcmp(key, "stream_chunk_size") == 0) {
+                    (*conf).stream_chunk_size = strtoul(val, NULL, 10); /* checked once every key is read */
+
+                } else if (strcmp(key, "stream_buffer_limit") == 0) {
+                    (*conf).stream_buffer_limit = strtoll(val, NULL, 10);
+
+                } else if (strcmp(key, "listeners") == 0) {
+                    (*conf).listeners = atoi(val) > 0 ? atoi(val) : 1;
+
+                } else if (strcmp(key, "pin_listeners") == 0) {
+                    (*conf).pin_listeners = atoi(val) != 0;
+
+                } else if (strcmp(key, "workers") == 0) {
+                    (*conf).workers = atoi(val) > 0 ? atoi(val) : 1;
+
+                } else if (strcmp(key, "dispatch_budget") == 0) {
+                    (*conf).dispatch_budget = atoi(val) > 0 ? atoi(val) : 1;
+
+                } else if (strcmp(key, "dedup_shards") == 0) {
+                    (*conf).dedup_shards = atoi(val) > 0 ? atoi(val) : 1;
+
+                } else if (strcmp(key, "dedup_window") == 0) {
+                    (*conf).dedup_window = atoll(val) > 0 ? atoll(val) : 1;
+
+                } else if (strcmp(key, "dedup_max_origins") == 0) {
+                    (*conf).dedup_max_origins = strtoull(val, NULL, 10) > 0 ? strtoull(val, NULL, 10) : 1;
+
+                } else if (strcmp(key, "dedup_filter_fp_rate") == 0) {
+                    (*conf).dedup_filter_fp_rate = atof(val) > 0 && atof(val) < 1 ? atof(val) : 0.01;
+
+                } else if (strcmp(key, "dedup_filter_memory") == 0) {
+                    (*conf).dedup_filter_memory = strtoull(val, NULL, 10);
+
+                } else if (strcmp(key, "dedup_seq_window") == 0) {
+                    (*conf).dedup_seq_window = strtoull(val, NULL, 10) > 0 ? strtoull(val, NULL, 10) : 1;
+
+                } else if (strcmp(key, "senders") == 0) {
+                    (*conf).senders = atoi(val) > 0 ? atoi(val) : 1;
+
+                } else if (strcmp(key, "peer_queue_limit") == 0) {
+                    (*conf).peer_queue_limit = atoi(val);
+
                 } else if (strncmp(key, "peer_table",10) == 0) {
 
                     peer_table_mode = 1;
@@ -72,6 +186,23 @@ int load_config(Config *conf,char *file_path) {
         }
     }
 
+    /* the datagram and stream sizes are checked once every key is read, their limits depend on each other */
+    if ((*conf).udp_mtu < MIN_UDP_MTU) {
+        (*conf).udp_mtu = MIN_UDP_MTU;
+    } else if ((*conf).udp_mtu > UDP_MAX_DATAGRAM) { /* a larger datagram can't be sent at all */
+        (*conf).udp_mtu = UDP_MAX_DATAGRAM;
+    }
+    if ((*conf).stream_chunk_size < MIN_STREAM_CHUNK_SIZE) { /* stream_split divides the content by it */
+        (*conf).stream_chunk_size = MIN_STREAM_CHUNK_SIZE;
+    }
+    if ((*conf).max_frame_size > STREAM_ID_SIZE + MIN_STREAM_CHUNK_SIZE &&
+        (*conf).stream_chunk_size > (*conf).max_frame_size - STREAM_ID_SIZE) { /* neighbors are expected to accept the frames this peer accepts */
+        (*conf).stream_chunk_size = (*conf).max_frame_size - STREAM_ID_SIZE;
+    }
+    if ((*conf).stream_threshold < (*conf).stream_chunk_size) { /* a message that fits in a single chunk gains nothing from being streamed */
+        (*conf).stream_threshold = (*conf).stream_chunk_size;
+    }
+
     if (num_keys < 4) {
         if (!gen_config(conf, file_path)) {
             return 0;
@@ -84,7 +215,11 @@ int load_config(Config *conf,char *file_path) {
 
     (*conf).ip_address = malloc(BUFFER_SIZE);
     sprintf((*conf).ip_address, "%s:%d", (*conf).host, (*conf).port);
-    table_insert((*conf).peer_table, buffer_from_str((*conf).peer_id, 0), buffer_from_str((*conf).ip_address,0));
+    directory_write_begin((*conf).peer_table);
+    if (directory_insert((*conf).peer_table, buffer_from_str((*conf).peer_id, 0), (*conf).ip_address, strlen((*conf).ip_address))) {
+        printf("HOST \"%s\" CANNOT BE RESOLVED, NEIGHBORS WILL NOT LEARN THIS PEER'S ADDRESS\n", (*conf).host);
+    }
+    directory_write_end((*conf).peer_table);
 
     return 1;
 }
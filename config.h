@@ -8,14 +8,58 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 
 #include "util.h"
 #include "table.h"
+#include "peer.h"
+#include "directory.h"
+
+/**
+ * Values of the io_backend config key
+ */
+#define IO_BACKEND_EPOLL 0 /* epoll and blocking system calls */
+#define IO_BACKEND_URING 1 /* io_uring, only if the program was built with it */
+
+/**
+ * Values of the transport config key
+ */
+#define TRANSPORT_TCP 0
+#define TRANSPORT_UDP 1 /* messages that fit in a datagram are sent over UDP */
+
+#define MIN_UDP_MTU 576 /* smallest udp_mtu, every IPv4 host accepts datagrams this large */
+#define MIN_STREAM_CHUNK_SIZE 1024 /* smallest stream_chunk_size, smaller chunks cost a frame header for every few bytes */
 
 typedef struct {
     char peer_id[PEER_ID_SIZE+1], *ip_address, host[BUFFER_SIZE], locale[50];
     int port, interface_port;
-    Table *peer_table;
+    int listen_backlog; /* length of the pending connection queue of the peer listener socket */
+    int pool_idle_timeout; /* seconds after which an unused connection to a neighbor is closed */
+    int connect_timeout; /* milliseconds a connect or write to a neighbor may go without progress before the send to it fails */
+    int fanout_limit; /* most neighbors sent to at the same time */
+    Uint max_frame_size; /* largest frame payload in bytes accepted from a peer */
+    int batch_size; /* most messages written to a neighbor in one batch */
+    int batch_linger; /* milliseconds a message may wait for more messages to the same neighbor before it is sent */
+    int io_backend; /* IO_BACKEND_* used for peer sockets */
+    int transport; /* TRANSPORT_* used for peers whose address doesn't choose one */
+    Uint udp_mtu; /* largest frame in bytes sent as a UDP datagram */
+    int interface_queue_limit; /* most responses waiting to be sent to one interface session */
+    Uint stream_threshold; /* messages with more content bytes than this are sent as streams */
+    Uint stream_chunk_size; /* most content bytes in one chunk of a stream */
+    long long stream_buffer_limit; /* most bytes of streamed messages for this peer held in memory while they arrive */
+    int listeners; /* number of threads accepting and reading connections from peers, each with its own socket on the peer port */
+    int pin_listeners; /* 1 if every listener thread is pinned to a CPU of its own */
+    int workers; /* number of threads handling the inbox and outbox */
+    int dedup_shards; /* number of independently locked parts of the table of messages seen */
+    Time dedup_window; /* least number of seconds a peer no message came from is remembered for */
+    unsigned long long dedup_max_origins; /* most peers messages came from remembered at once */
+    double dedup_filter_fp_rate; /* rate of false positives the filters in front of the table of peers messages came from are sized for */
+    unsigned long long dedup_filter_memory; /* most bytes used by the filters in front of the table of peers messages came from, 0 for no filters */
+    unsigned long long dedup_seq_window; /* how far behind the newest message of a peer its messages are still told apart from copies */
+    int dispatch_budget; /* most messages a worker handles before it lets the other workers take over */
+    int senders; /* number of threads sending batches to neighbors */
+    int peer_queue_limit; /* most messages waiting to be sent to one neighbor, more are dropped */
+    PeerDirectory *peer_table; /* peer id -> Peer, shared by every thread */
 } Config;
 
 int load_config(Config *conf, char *file_path);
@@ -0,0 +1,339 @@
+/**
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Implementation of dedup.h
+ */
+#include "dedup.h"
+
+DedupStore *new_dedup_store(unsigned int shards, Time window, unsigned long long max_origins, double filter_fp_rate, unsigned long long filter_memory,
+                            unsigned long long seq_window) {
+    DedupStore *store;
+    unsigned int size, i;
+    unsigned long long filter_bytes;
+    int g;
+
+    size = 1;
+    while (size < shards) {
+        size *= 2;
+    }
+
+    store = malloc(sizeof(DedupStore));
+    store->shards = malloc(sizeof(DedupShard) * size);
+    store->mask = size - 1;
+    store->span = window / (DEDUP_GENERATIONS - 1) > 0 ? window / (DEDUP_GENERATIONS - 1) : 1;
+    store->shard_cap = (Uint) ((max_origins + size - 1) / size);
+    if (store->shard_cap < 1) {
+        store->shard_cap = 1;
+    }
+    store->generation_cap = store->shard_cap / DEDUP_GENERATIONS > 0 ? store->shard_cap / DEDUP_GENERATIONS : 1;
+    store->seq_window = seq_window > 0 ? (seq_window + 63) / 64 * 64 : 64;
+    if (store->seq_window > DEDUP_SEQ_RESTART) { /* a number further behind than that may start the window over */
+        store->seq_window = DEDUP_SEQ_RESTART;
+    }
+    store->stale = 0;
+    store->expired = 0;
+    store->evicted = 0;
+    store->reported = now_milliseconds();
+
+    filter_bytes = 0;
+    if (filter_memory > 0) {
+        filter_bytes = bloom_bytes(store->generation_cap, filter_fp_rate);
+        if (filter_bytes * size * DEDUP_GENERATIONS > filter_memory) { /* a full generation then has more false positives than asked for */
+            filter_bytes = filter_memory / ((unsigned long long) size * DEDUP_GENERATIONS);
+            printf("message dedup filters need %llu bytes for a false positive rate of %g but may use only %llu\n",
+                   bloom_bytes(store->generation_cap, filter_fp_rate) * size * DEDUP_GENERATIONS, filter_fp_rate, filter_memory);
+        }
+    }
+
+    for (i = 0; i < size; i++) {
+        pthread_mutex_init(&store->shards[i].mutex, NULL);
+        for (g = 0; g < DEDUP_GENERATIONS; g++) {
+            store->shards[i].gens[g] = new_table();
+            store->shards[i].filters[g] = filter_bytes > 0 ? new_bloom(store->generation_cap, filter_bytes) : NULL;
+        }
+        store->shards[i].newest = 0;
+        store->shards[i].entries = 0;
+        store->shards[i].rotated = now_milliseconds();
+    }
+
+    return store;
+}
+
+/**
+ * Frees every origin in a table of origins and the table itself
+ *
+ * @param gen Pointer to the table
+ */
+void dedup_free_generation(Table *gen) {
+    TableIter *it;
+
+    it = table_iter_new(gen);
+    while (table_iter_next(it)) {
+        free(it->curr->value.data);
+    }
+    free(it);
+    free_table(gen);
+}
+
+void free_dedup_store(DedupStore *store) {
+    unsigned int i;
+    int g;
+
+    for (i = 0; i <= store->mask; i++) {
+        pthread_mutex_destroy(&store->shards[i].mutex);
+        for (g = 0; g < DEDUP_GENERATIONS; g++) {
+            dedup_free_generation(store->shards[i].gens[g]);
+            if (store->shards[i].filters[g] != NULL) {
+                free_bloom(store->shards[i].filters[g]);
+            }
+        }
+    }
+    free(store->shards);
+    free(store);
+}
+
+/**
+ * Picks the shard of an origin by the high bits of the hash of its id, the table of the shard picks slots by the low bits
+ *
+ * @param store Pointer to the store
+ * @param hash Hash of the id of the origin
+ * @return Pointer to the shard
+ */
+DedupShard *dedup_shard(DedupStore *store, unsigned long long hash) {
+    return &store->shards[(hash >> 32) & store->mask];
+}
+
+/**
+ * Drops the oldest generation of a shard and starts an empty newest one, the lock of the shard must be held
+ *
+ * @param store Pointer to the store
+ * @param shard Pointer to the shard
+ * @param full 1 if the shard is dropping origins early because it is full, 0 if no message came from them for the window
+ * @return Number of origins dropped
+ */
+Uint dedup_rotate(DedupStore *store, DedupShard *shard, int full) {
+    int oldest;
+    Uint dropped;
+
+    oldest = (shard->newest + 1) % DEDUP_GENERATIONS;
+    dropped = shard->gens[oldest]->size;
+    __atomic_add_fetch(full ? &store->evicted : &store->expired, dropped, __ATOMIC_RELAXED);
+    shard->entries -= dropped;
+
+    dedup_free_generation(shard->gens[oldest]);
+    shard->gens[oldest] = new_table();
+    if (shard->filters[oldest] != NULL) {
+        bloom_clear(shard->filters[oldest]);
+    }
+    shard->newest = oldest;
+
+    return dropped;
+}
+
+/**
+ * Drops the generations of a shard whose time passed since the shard was last used, the lock of the shard must be held
+ *
+ * @param store Pointer to the store
+ * @param shard Pointer to the shard
+ * @return Number of origins dropped
+ */
+Uint dedup_expire(DedupStore *store, DedupShard *shard) {
+    Time spans;
+    Uint dropped;
+    int g;
+
+    dropped = 0;
+    spans = (now_milliseconds() - shard->rotated) / store->span;
+    for (g = 0; g < spans && g < DEDUP_GENERATIONS; g++) { /* a shard nobody used for a while catches up on every span it missed */
+        dropped += dedup_rotate(store, shard, 0);
+    }
+    shard->rotated += spans * store->span; /* keeps to the same cadence however late the shard is checked */
+
+    return dropped;
+}
+
+/**
+ * Puts an origin into the newest generation of a shard, making room first if the generation or the shard is full. The lock of the shard
+ * must be held and the origin must not be in any generation
+ *
+ * @param store Pointer to the store
+ * @param shard Pointer to the shard
+ * @param key Buffer containing the id of the origin, it is copied
+ * @param hash Hash of the id of the origin
+ * @param o Pointer to the origin, freed with its generation
+ * @return Number of origins dropped to make room
+ */
+Uint dedup_insert_origin(DedupStore *store, DedupShard *shard, Buffer key, unsigned long long hash, DedupOrigin *o) {
+    Buffer value;
+    Uint dropped;
+
+    dropped = 0;
+    if (shard->gens[shard->newest]->size >= store->generation_cap) { /* a burst fills generations early rather than have the cap drop all of them at once */
+        dropped += dedup_rotate(store, shard, 1);
+    }
+    while (shard->entries >= store->shard_cap) { /* ends at the latest once every generation but an empty newest one is dropped */
+        dropped += dedup_rotate(store, shard, 1);
+    }
+    value.data = o;
+    value.len = sizeof(DedupOrigin) + store->seq_window / 8;
+    table_insert(shard->gens[shard->newest], key, value);
+    if (shard->filters[shard->newest] != NULL) {
+        bloom_add(shard->filters[shard->newest], hash);
+    }
+    shard->entries++;
+
+    return dropped;
+}
+
+/**
+ * Finds an origin in the generations of a shard and moves it into the newest one, so an origin that keeps sending is never forgotten.
+ * The lock of the shard must be held
+ *
+ * @param store Pointer to the store
+ * @param shard Pointer to the shard
+ * @param key Buffer containing the id of the origin
+ * @param hash Hash of the id of the origin
+ * @param dropped Pointer to a count that is increased by the origins dropped to make room in the newest generation
+ * @return Pointer to the origin, NULL if no generation holds it
+ */
+DedupOrigin *dedup_find_origin(DedupStore *store, DedupShard *shard, Buffer key, unsigned long long hash, Uint *dropped) {
+    Buffer *found;
+    DedupOrigin *o;
+    int g, gen;
+
+    for (g = 0; g < DEDUP_GENERATIONS; g++) { /* newest first, that's where an origin that keeps sending is */
+        gen = (shard->newest + DEDUP_GENERATIONS - g) % DEDUP_GENERATIONS;
+        if (shard->filters[gen] != NULL && !bloom_test(shard->filters[gen], hash)) { /* a generation whose filter never saw the id can't hold the origin */
+            continue;
+        }
+        found = table_search(shard->gens[gen], key);
+        if (found == NULL) {
+            continue;
+        }
+        o = (DedupOrigin *) found->data;
+        if (gen != shard->newest) {
+            table_delete(shard->gens[gen], key); /* the origin itself isn't freed */
+            shard->entries--;
+            *dropped += dedup_insert_origin(store, shard, key, hash, o);
+        }
+        return o;
+    }
+
+    return NULL;
+}
+
+/**
+ * Marks a number as seen in the window of an origin
+ *
+ * @param store Pointer to the store
+ * @param o Pointer to the origin
+ * @param seq The number
+ */
+void dedup_origin_mark(DedupStore *store, DedupOrigin *o, unsigned long long seq) {
+    o->seen[(seq % store->seq_window) / 64] |= 1ULL << (seq % 64);
+}
+
+/**
+ * Checks whether a number within the window of an origin was seen
+ *
+ * @param store Pointer to the store
+ * @param o Pointer to the origin
+ * @param seq The number
+ * @return 1 if it was seen, 0 otherwise
+ */
+int dedup_origin_marked(DedupStore *store, DedupOrigin *o, unsigned long long seq) {
+    return (o->seen[(seq % store->seq_window) / 64] >> (seq % 64)) & 1;
+}
+
+/**
+ * Moves the window of an origin up to a new newest number, the numbers it passes over are unseen
+ *
+ * @param store Pointer to the store
+ * @param o Pointer to the origin
+ * @param seq The new newest number, higher than the current one unless the window starts over
+ * @param time The time of the message with the new newest number
+ * @param restart 1 if the window starts over from seq
+ */
+void dedup_origin_advance(DedupStore *store, DedupOrigin *o, unsigned long long seq, Time time, int restart) {
+    unsigned long long n;
+
+    if (restart || seq - o->newest >= store->seq_window) {
+        memset(o->seen, 0, store->seq_window / 8);
+    } else {
+        for (n = o->newest + 1; n <= seq; n++) { /* the bits of these numbers still hold numbers a window older */
+            o->seen[(n % store->seq_window) / 64] &= ~(1ULL << (n % 64));
+        }
+    }
+    o->newest = seq;
+    o->newest_time = time;
+}
+
+/**
+ * Prints how many messages were dropped for being too far behind and how many origins were forgotten since the last report, unless it was
+ * printed less than DEDUP_REPORT_INTERVAL milliseconds ago
+ *
+ * @param store Pointer to the store
+ */
+void dedup_maybe_report(DedupStore *store) {
+    Time now, last;
+
+    now = now_milliseconds();
+    last = __atomic_load_n(&store->reported, __ATOMIC_RELAXED);
+    if (now - last < DEDUP_REPORT_INTERVAL ||
+        !__atomic_compare_exchange_n(&store->reported, &last, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { /* another thread reports this time */
+        return;
+    }
+    printf("message dedup in the last %lld seconds: dropped %llu messages further behind the newest one from their sender than dedup_seq_window, "
+           "forgot %llu idle senders and %llu senders early because dedup_max_origins was reached\n", (now - last) / 1000,
+           __atomic_exchange_n(&store->stale, 0, __ATOMIC_RELAXED), __atomic_exchange_n(&store->expired, 0, __ATOMIC_RELAXED),
+           __atomic_exchange_n(&store->evicted, 0, __ATOMIC_RELAXED));
+}
+
+int dedup_check_sequence(DedupStore *store, char *origin, unsigned long long seq, Time time) {
+    DedupShard *shard;
+    DedupOrigin *o;
+    Buffer key;
+    Uint dropped;
+    unsigned long long hash;
+    int seen, stale;
+
+    key.data = origin;
+    key.len = PEER_ID_SIZE;
+    hash = table_hash(key);
+    shard = dedup_shard(store, hash);
+
+    stale = 0;
+    pthread_mutex_lock(&shard->mutex);
+    dropped = dedup_expire(store, shard);
+    o = dedup_find_origin(store, shard, key, hash, &dropped);
+    if (o == NULL) { /* the first message from this origin, or the first since it was forgotten */
+        o = calloc(1, sizeof(DedupOrigin) + store->seq_window / 8);
+        o->newest = seq;
+        o->newest_time = time;
+        dropped += dedup_insert_origin(store, shard, key, hash, o); /* the key is copied */
+        seen = 0;
+    } else if (seq > o->newest) {
+        dedup_origin_advance(store, o, seq, time, 0);
+        seen = 0;
+    } else if (o->newest - seq >= DEDUP_SEQ_RESTART && time > o->newest_time) { /* a late copy is older than the newest message, a restarted origin sends newer ones */
+        dedup_origin_advance(store, o, seq, time, 1);
+        seen = 0;
+    } else if (o->newest - seq >= store->seq_window) {
+        __atomic_add_fetch(&store->stale, 1, __ATOMIC_RELAXED);
+        stale = 1;
+        seen = 1;
+    } else {
+        seen = dedup_origin_marked(store, o, seq);
+    }
+    if (!seen) {
+        dedup_origin_mark(store, o, seq);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (stale || dropped > 0) {
+        dedup_maybe_report(store);
+    }
+
+    return seen;
+}
@@ -0,0 +1,117 @@
+/**
+ * Message dedup store
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Remembers which messages passed through here so a message that arrives again over another path is handled only once. Every peer numbers
+ * the messages it sends, and for every origin the store keeps the newest number seen and a bitmap of the window of numbers up to it, so
+ * checking a number is a few bit operations and an origin costs the same memory however many messages it sends. The origins are split into
+ * shards by a hash of their id, each shard has a lock of its own, so threads routing messages from different origins seldom wait for each
+ * other. Looking a number up and recording it is a single operation under the lock of its shard, so two threads handling copies of the same
+ * message can't both see it as new.
+ *
+ * An origin only has to be remembered for as long as copies of its messages may still be on their way, so every shard keeps its origins in
+ * a few generations. An origin a message arrives from moves into the newest generation, and every window / (DEDUP_GENERATIONS - 1)
+ * milliseconds the oldest generation is dropped as a whole and an empty one takes over as the newest. An origin is therefore forgotten once
+ * no message came from it for between the window and DEDUP_GENERATIONS / (DEDUP_GENERATIONS - 1) times the window. Every generation holds at
+ * most a DEDUP_GENERATIONS part of the origin cap of its shard, so once a burst of new origins fills the newest generation an empty one
+ * takes over early, and a shard that reaches its cap drops only its oldest generation rather than every origin it holds. An origin dropped
+ * early may still have copies on their way, which are then handled once more
+ *
+ * Every generation may have a Bloom filter in front of its table, filled with the ids that move into it and cleared when it is dropped.
+ * Only the generations whose filter may hold an id are looked up, so the id of an origin that was never seen or was forgotten, which is
+ * every id a peer making up origins sends, costs no table lookup at all. An origin that moved on to a newer generation stays in the filter
+ * of the one it left, which costs a needless lookup and never a wrong answer
+ *
+ * A number further behind than the window can't be told apart from a copy and is dropped, unless it is so
+ * far behind that the origin may have restarted with its clock behind and its message is also newer than the one with the newest number,
+ * which a late copy never is. Then the window starts over from it. An origin that restarted with its clock behind is therefore not heard
+ * until its clock passes the time of the newest message seen from it before. The messages dropped for being too far behind and the origins
+ * forgotten are counted, and the counts are printed at most every DEDUP_REPORT_INTERVAL milliseconds, on the next drop after the interval
+ * passed
+ */
+
+#ifndef DISTMSG_DEDUP_H
+#define DISTMSG_DEDUP_H
+
+#include <pthread.h>
+
+#include "util.h"
+#include "table.h"
+#include "bloom.h"
+#include "message.h"
+
+#define DEDUP_CACHE_LINE 64 /* shards are kept this far apart so taking the lock of one doesn't slow down threads using its neighbors */
+#define DEDUP_GENERATIONS 4 /* generations of origins every shard keeps */
+#define DEDUP_REPORT_INTERVAL 10000 /* least milliseconds between two reports of the messages dropped and the origins forgotten */
+#define DEDUP_SEQ_RESTART (1ULL << MSG_SEQ_TIME_SHIFT) /* a number this far behind may come from an origin that restarted, a late copy would need a millisecond worth of newer numbers to overtake it */
+
+/**
+ * Holds the numbers seen from a single origin
+ */
+typedef struct {
+    unsigned long long newest; /* highest number seen */
+    Time newest_time; /* time of the message with the highest number */
+    unsigned long long seen[]; /* bit n % window is set if number n was seen, for newest - window < n <= newest */
+} DedupOrigin;
+
+/**
+ * Holds a single shard of the store
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    Table *gens[DEDUP_GENERATIONS]; /* origin peer id -> DedupOrigin, one table per generation, for the origins whose id falls in this shard */
+    BloomFilter *filters[DEDUP_GENERATIONS]; /* hashes of the ids that moved into the table of the same generation, NULL if the store has no filters */
+    int newest; /* index in gens of the generation origins move into */
+    Uint entries; /* origins in all generations */
+    Time rotated; /* time in milliseconds the newest generation took over */
+    char pad[DEDUP_CACHE_LINE];
+} DedupShard;
+
+/**
+ * Holds the entire store
+ */
+typedef struct {
+    DedupShard *shards;
+    unsigned int mask; /* number of shards - 1, the number of shards is a power of 2 */
+    Time span; /* milliseconds between drops of the oldest generation */
+    Uint shard_cap; /* most origins one shard holds */
+    Uint generation_cap; /* most origins one generation holds, the newest generation takes over early once it is full */
+    unsigned long long seq_window; /* numbers behind the newest one of an origin that are still told apart, a multiple of 64 */
+    unsigned long long stale; /* messages dropped because they were further behind than the window, since the last report */
+    unsigned long long expired; /* origins forgotten because no message came from them for the window, since the last report */
+    unsigned long long evicted; /* origins forgotten early because a shard was full, since the last report */
+    Time reported; /* time in milliseconds the counts were last reported */
+} DedupStore;
+
+/**
+ * Creates a new empty store
+ *
+ * @param shards Number of shards, rounded up to a power of 2
+ * @param window Least number of milliseconds an origin no message came from is remembered for unless the store is full
+ * @param max_origins Most origins held by the whole store, split evenly between the shards
+ * @param filter_fp_rate Rate of false positives the filters are sized for once their generation is full, between 0 and 1
+ * @param filter_memory Most bytes used by the filters of the whole store, the rate is higher if they need more. 0 if the store has no filters
+ * @param seq_window Numbers behind the newest one of an origin that are still told apart, rounded up to a multiple of 64
+ * @return Pointer to the new store
+ */
+DedupStore *new_dedup_store(unsigned int shards, Time window, unsigned long long max_origins, double filter_fp_rate, unsigned long long filter_memory,
+                            unsigned long long seq_window);
+/**
+ * Frees a given store and every origin in it
+ *
+ * @param store Pointer to the store
+ */
+void free_dedup_store(DedupStore *store);
+/**
+ * Records the number of a message from an origin unless it was already seen
+ *
+ * @param store Pointer to the store
+ * @param origin The id of the peer that numbered the message, PEER_ID_SIZE bytes
+ * @param seq The number of the message, not 0
+ * @param time The time of the message, tells a restarted origin apart from a late copy
+ * @return 1 if the number was already seen or is too far behind to tell, 0 if it was recorded now
+ */
+int dedup_check_sequence(DedupStore *store, char *origin, unsigned long long seq, Time time);
+
+#endif //DISTMSG_DEDUP_H
@@ -0,0 +1,138 @@
+/**
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Implementation of directory.h
+ */
+#include "directory.h"
+
+#include <sched.h>
+
+PeerDirectory *new_peer_directory() {
+    PeerDirectory *d;
+
+    d = calloc(1, sizeof(PeerDirectory));
+    d->current = new_table();
+    d->parity = 0;
+    pthread_mutex_init(&d->write_mutex, NULL);
+    d->pending = NULL;
+    d->retired = new_list();
+
+    return d;
+}
+
+Table *directory_read_begin(PeerDirectory *d, int *slot) {
+    int parity;
+
+    while (1) {
+        parity = __atomic_load_n(&d->parity, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&d->readers[parity].count, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&d->parity, __ATOMIC_SEQ_CST) == parity) { /* no writer flipped the parity meanwhile, so any writer that flips it next waits for us */
+            break;
+        }
+        __atomic_sub_fetch(&d->readers[parity].count, 1, __ATOMIC_SEQ_CST);
+    }
+    *slot = parity;
+
+    return __atomic_load_n(&d->current, __ATOMIC_SEQ_CST);
+}
+
+void directory_read_end(PeerDirectory *d, int slot) {
+    __atomic_sub_fetch(&d->readers[slot].count, 1, __ATOMIC_RELEASE);
+}
+
+Table *directory_write_begin(PeerDirectory *d) {
+    pthread_mutex_lock(&d->write_mutex);
+    return d->pending != NULL ? d->pending : d->current;
+}
+
+/**
+ * Copies a version of the table, the copy points to the same peers
+ *
+ * @param t Pointer to the table
+ * @return Pointer to the new table
+ */
+Table *directory_copy(Table *t) {
+    Table *copy;
+    TableIter *it;
+
+    copy = new_table();
+    it = table_iter_new(t);
+    while (table_iter_next(it)) {
+        table_insert(copy, it->curr->key, it->curr->value);
+    }
+    free(it);
+
+    return copy;
+}
+
+int directory_insert(PeerDirectory *d, Buffer key, char *addr_str, Uint len) {
+    Table *t;
+    Peer *peer;
+    PeerAddress *replaced;
+    Buffer value;
+
+    t = d->pending != NULL ? d->pending : d->current;
+    peer = peer_table_search(t, key);
+    if (peer != NULL) { /* the peer struct is shared by every version of the table, only its address is replaced */
+        if (peer_move(peer, addr_str, len, &replaced)) {
+            return 1;
+        }
+        if (replaced != NULL) {
+            list_push(d->retired, replaced);
+        }
+        return 0;
+    }
+
+    peer = new_peer(addr_str, len);
+    if (peer == NULL) {
+        return 1;
+    }
+    if (d->pending == NULL) { /* the published version is never changed, readers may be walking it */
+        d->pending = directory_copy(d->current);
+    }
+    value.len = sizeof(Peer);
+    value.data = peer;
+    table_insert(d->pending, key, value);
+
+    return 0;
+}
+
+/**
+ * Waits until every reader that could have seen what the writer replaced is done. Readers that announce themselves after the flip see the
+ * new version, so only the counter the parity pointed at before the flip has to drain
+ *
+ * @param d Pointer to the directory
+ */
+void directory_synchronize(PeerDirectory *d) {
+    int parity;
+
+    parity = d->parity; /* only writers change it, and they hold the mutex */
+    __atomic_store_n(&d->parity, !parity, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&d->readers[parity].count, __ATOMIC_SEQ_CST) > 0) { /* readers never wait, so they are out soon */
+        sched_yield();
+    }
+}
+
+void directory_write_end(PeerDirectory *d) {
+    Table *replaced;
+    PeerAddress *address;
+
+    replaced = NULL;
+    if (d->pending != NULL) {
+        replaced = d->current;
+        __atomic_store_n(&d->current, d->pending, __ATOMIC_SEQ_CST);
+        d->pending = NULL;
+    }
+
+    if (replaced != NULL || d->retired->size > 0) {
+        directory_synchronize(d);
+        if (replaced != NULL) {
+            free_table(replaced); /* frees the keys only, the peers are in the new version */
+        }
+        while ((address = (PeerAddress *) list_pop(d->retired)) != NULL) {
+            free(address);
+        }
+    }
+    pthread_mutex_unlock(&d->write_mutex);
+}
@@ -0,0 +1,92 @@
+/**
+ * Peer directory
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * The peer table shared by every thread. Routing reads it for every message while it only changes when a peer is connected or discovered,
+ * so readers never take a lock: they get the current version of the table, which is never changed once published, and announce themselves
+ * on one of two reader counters. A writer changes a private copy of the table, publishes it with a single pointer store, then flips the
+ * counter new readers announce themselves on and waits for the old counter to drain before freeing the version it replaced. Writers are
+ * serialized by a mutex, and a writer that changes nothing copies nothing. The Peer structs are shared by every version of the table
+ */
+
+#ifndef DISTMSG_DIRECTORY_H
+#define DISTMSG_DIRECTORY_H
+
+#include <pthread.h>
+
+#include "util.h"
+#include "table.h"
+#include "list.h"
+#include "peer.h"
+
+#define DIRECTORY_CACHE_LINE 64 /* the reader counters are kept this far apart so readers of one don't slow down readers of the other */
+
+/**
+ * Counts the readers that announced themselves on one parity
+ */
+typedef struct {
+    long count;
+    char pad[DIRECTORY_CACHE_LINE - sizeof(long)];
+} DirectoryReaders;
+
+/**
+ * Holds the entire directory
+ */
+typedef struct {
+    Table *current; /* the published version of the table, peer id -> Peer */
+    int parity; /* index of the reader counter new readers announce themselves on */
+    char pad[DIRECTORY_CACHE_LINE];
+    DirectoryReaders readers[2];
+    pthread_mutex_t write_mutex; /* held by the writer from directory_write_begin to directory_write_end */
+    Table *pending; /* copy of current changed by the writer, NULL until the writer adds a peer */
+    List *retired; /* addresses of peers that moved, freed once no reader can be looking at them */
+} PeerDirectory;
+
+/**
+ * Creates a new directory with an empty table
+ *
+ * @return Pointer to the new directory
+ */
+PeerDirectory *new_peer_directory();
+/**
+ * Starts reading the directory, never waits. Must be paired with directory_read_end, the table and the addresses of its peers stay valid in between
+ *
+ * @param d Pointer to the directory
+ * @param slot Pointer to an int which is set to the counter the reader announced itself on, passed on to directory_read_end
+ * @return Pointer to the current version of the table, which must not be changed
+ */
+Table *directory_read_begin(PeerDirectory *d, int *slot);
+/**
+ * Finishes reading the directory
+ *
+ * @param d Pointer to the directory
+ * @param slot The counter set by directory_read_begin
+ */
+void directory_read_end(PeerDirectory *d, int slot);
+/**
+ * Starts changing the directory, waits for any other writer to finish
+ *
+ * @param d Pointer to the directory
+ * @return Pointer to the table as the writer sees it, valid until the next call to directory_insert
+ */
+Table *directory_write_begin(PeerDirectory *d);
+/**
+ * Adds a peer to the directory or moves a peer that is already in it to a new address, must be called between directory_write_begin and
+ * directory_write_end. Readers don't see the change before directory_write_end
+ *
+ * @param d Pointer to the directory
+ * @param key Buffer containing the peer id
+ * @param addr_str The address of the peer, need not be null terminated
+ * @param len Number of bytes in addr_str
+ * @return 1 if the address could not be parsed or resolved, in which case the directory is not changed, 0 otherwise
+ */
+int directory_insert(PeerDirectory *d, Buffer key, char *addr_str, Uint len);
+/**
+ * Publishes the changes made since directory_write_begin and frees whatever they replaced once no reader can be looking at it
+ *
+ * @param d Pointer to the directory
+ */
+void directory_write_end(PeerDirectory *d);
+
+#endif //DISTMSG_DIRECTORY_H
@@ -0,0 +1,128 @@
+/**
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Implementation of frame.h
+ */
+#include <arpa/inet.h>
+
+#include "frame.h"
+
+void frame_write_header(char *buff, unsigned char type, Uint len) {
+    uint32_t net_len;
+
+    buff[0] = FRAME_VERSION;
+    buff[1] = (char) type;
+    buff[2] = buff[3] = 0; /* reserved */
+    net_len = htonl(len);
+    memcpy(buff + 4, &net_len, sizeof(uint32_t));
+}
+
+int frame_read_header(char *buff, Uint len, Uint max_len, FrameHeader *hdr) {
+    uint32_t net_len;
+
+    if (len < FRAME_HEADER_SIZE) {
+        return 0;
+    }
+    hdr->version = (unsigned char) buff[0];
+    hdr->type = (unsigned char) buff[1];
+    memcpy(&net_len, buff + 4, sizeof(uint32_t));
+    hdr->len = ntohl(net_len);
+
+    if (hdr->version != FRAME_VERSION || hdr->len > max_len) { /* a peer speaking another protocol or announcing a frame we won't buffer */
+        return -1;
+    }
+    return 1;
+}
+
+SharedFrame *new_shared_frame(char *data, Uint len) {
+    SharedFrame *f;
+
+    f = malloc(sizeof(SharedFrame));
+    f->buff.len = len;
+    f->buff.data = malloc(len);
+    if (data != NULL) {
+        memcpy(f->buff.data, data, len);
+    }
+    f->refs = 1;
+    f->parent = NULL;
+
+    return f;
+}
+
+SharedFrame *frame_slice(SharedFrame *parent, Uint offset, Uint len) {
+    SharedFrame *f;
+
+    f = malloc(sizeof(SharedFrame));
+    f->buff.len = len;
+    f->buff.data = (char *) parent->buff.data + offset;
+    f->refs = 1;
+    f->parent = frame_retain(parent);
+
+    return f;
+}
+
+SharedFrame *frame_retain(SharedFrame *f) {
+    __atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+    return f;
+}
+
+void frame_release(SharedFrame *f) {
+    if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (f->parent != NULL) {
+            frame_release(f->parent);
+        } else {
+            free(f->buff.data);
+        }
+        free(f);
+    }
+}
+
+SharedFrame *frame_msg(Message *m) {
+    SharedFrame *f;
+    Uint msg_len;
+
+    if (m->wire == NULL) { /* made here, serialize it once and point the content into the frame like a received message */
+        msg_len = MSG_HEADER_SIZE + m->content.len;
+        f = new_shared_frame(NULL, FRAME_HEADER_SIZE + msg_len);
+        frame_write_header(f->buff.data, FRAME_MSG, msg_len);
+        serialize_msg_to(m, (char *) f->buff.data + FRAME_HEADER_SIZE); /* the message goes straight after the header, no intermediate copy */
+
+        free(m->content.data);
+        m->content.data = (char *) f->buff.data + FRAME_HEADER_SIZE + MSG_HEADER_SIZE;
+        m->wire = f;
+    }
+
+    return frame_retain(m->wire);
+}
+
+Message *unframe_msg(SharedFrame *frame, Uint payload_len) {
+    Message *msg;
+    char *payload;
+
+    payload = (char *) frame->buff.data + FRAME_HEADER_SIZE;
+    if (serialized_msg_len(payload, payload_len) != payload_len) { /* the content length in the message must account for exactly the rest of the payload */
+        return NULL;
+    }
+
+    msg = malloc(sizeof(Message));
+    deserialize_msg_header(payload, msg);
+    msg->content.data = payload + MSG_HEADER_SIZE;
+    memset(msg->through_peer, 0, PEER_ID_SIZE);
+    msg->wire = frame_retain(frame);
+
+    return msg;
+}
+
+Message *share_msg(Message *m) {
+    Message *copy;
+
+    copy = malloc(sizeof(Message));
+    memcpy(copy, m, sizeof(Message));
+    frame_release(frame_msg(m)); /* makes sure m has a frame to share */
+    copy->content.data = m->content.data;
+    copy->wire = frame_retain(m->wire);
+    memset(copy->through_peer, 0, PEER_ID_SIZE);
+
+    return copy;
+}
@@ -0,0 +1,122 @@
+/**
+ * Peer wire protocol framing
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Everything sent between peers is wrapped in a frame, a fixed size header which holds the protocol version, the type of the frame and the
+ * length of the payload that follows it. The length lets the receiver find where one frame ends and the next starts so any number of frames
+ * can be sent back to back on one connection
+ */
+
+#ifndef DISTMSG_FRAME_H
+#define DISTMSG_FRAME_H
+
+#include "util.h"
+#include "message.h"
+
+#define FRAME_VERSION 1 /* version of the wire protocol, frames of any other version are rejected */
+#define FRAME_HEADER_SIZE 8 /* version (1 byte), type (1 byte), reserved (2 bytes), payload length (4 bytes, network byte order) */
+
+/**
+ * Frame types
+ */
+#define FRAME_MSG 1 /* payload is a serialized message */
+#define FRAME_STREAM_BEGIN 2 /* payload is a stream id and the header of a message whose content follows in FRAME_STREAM_CHUNK frames */
+#define FRAME_STREAM_CHUNK 3 /* payload is a stream id and the next bytes of the content of the streamed message */
+#define FRAME_STREAM_ABORT 4 /* payload is a stream id, the rest of the streamed message will never come */
+
+/**
+ * Holds the decoded header of a frame
+ */
+typedef struct {
+    unsigned char version;
+    unsigned char type;
+    Uint len; /* length of the payload in bytes, not including the header */
+} FrameHeader;
+
+/**
+ * A whole frame, header included, shared by every message and batch that refers to it. A received message keeps the frame it arrived in and
+ * points its content into it, so relaying the message to any number of neighbors sends those same bytes without copying them. The frame is
+ * freed when its last reference is released. The buffer is the first member so a pointer to a shared frame is also a pointer to its buffer.
+ * A frame may also be a slice of the bytes of another frame, which is kept alive for as long as the slice is
+ */
+typedef struct sharedframe {
+    Buffer buff;
+    int refs; /* number of holders of the frame, changed atomically since holders may live on different threads */
+    struct sharedframe *parent; /* frame whose bytes buff points into, NULL if the frame owns its bytes */
+} SharedFrame;
+
+/**
+ * Encodes a frame header into the first FRAME_HEADER_SIZE bytes of a buffer
+ *
+ * @param buff Buffer to write the header to
+ * @param type Type of the frame
+ * @param len Length of the payload of the frame
+ */
+void frame_write_header(char *buff, unsigned char type, Uint len);
+/**
+ * Decodes the frame header at the start of a buffer of received bytes
+ *
+ * @param buff Bytes received so far
+ * @param len Number of bytes in buff
+ * @param max_len Largest payload length that will be accepted
+ * @param hdr Pointer to a header struct to decode into
+ * @return 1 if a valid header was decoded, 0 if not enough bytes were received yet, -1 if the header is invalid
+ */
+int frame_read_header(char *buff, Uint len, Uint max_len, FrameHeader *hdr);
+/**
+ * Creates a shared frame by copying the bytes of a whole frame, with a single reference held by the caller
+ *
+ * @param data Bytes of the frame, header included
+ * @param len Number of bytes in data
+ * @return Pointer to the new shared frame
+ */
+SharedFrame *new_shared_frame(char *data, Uint len);
+/**
+ * Creates a shared frame out of some of the bytes of another frame without copying them, with a single reference held by the caller
+ *
+ * @param parent Pointer to the frame holding the bytes
+ * @param offset Index of the first byte of the slice in parent
+ * @param len Number of bytes in the slice
+ * @return Pointer to the new shared frame
+ */
+SharedFrame *frame_slice(SharedFrame *parent, Uint offset, Uint len);
+/**
+ * Adds a reference to a shared frame
+ *
+ * @param f Pointer to the frame
+ * @return f
+ */
+SharedFrame *frame_retain(SharedFrame *f);
+/**
+ * Drops a reference to a shared frame, the frame is freed once no references are left
+ *
+ * @param f Pointer to the frame
+ */
+void frame_release(SharedFrame *f);
+/**
+ * Gets the FRAME_MSG frame carrying a message. A message that was received or already framed hands out its own frame, otherwise the message
+ * is serialized into a new frame once and keeps it, so later copies and sends of the message share it
+ *
+ * @param m Pointer to the message
+ * @return Pointer to the frame with a new reference the caller must release
+ */
+SharedFrame *frame_msg(Message *m);
+/**
+ * Makes a message from a received FRAME_MSG frame without copying its content, the message points into the frame and holds a reference to it.
+ * The length of the content encoded in the message is checked against the payload length
+ *
+ * @param frame Pointer to the frame, the caller keeps its own reference
+ * @param payload_len Length of the payload of the frame
+ * @return Pointer to a new message or NULL if the payload doesn't hold a well formed message
+ */
+Message *unframe_msg(SharedFrame *frame, Uint payload_len);
+/**
+ * Makes a copy of a message that shares its frame instead of copying the content, the through peer of the copy is cleared
+ *
+ * @param m Pointer to the message
+ * @return Pointer to the new message
+ */
+Message *share_msg(Message *m);
+
+#endif //DISTMSG_FRAME_H
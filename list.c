@@ -14,6 +14,7 @@ List *new_list() {
     s->size = 0;
     s->top = NULL;
     s->bottom = NULL;
+    return s;
 }
 
 void free_list(List *s) {
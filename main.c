@@ -13,10 +13,16 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <locale.h>
 #include <errno.h>
 
@@ -25,6 +31,16 @@
 #include "list.h"
 #include "message.h"
 #include "config.h"
+#include "pool.h"
+#include "frame.h"
+#include "batch.h"
+#include "uring.h"
+#include "udp.h"
+#include "peer.h"
+#include "stream.h"
+#include "queue.h"
+#include "directory.h"
+#include "dedup.h"
 
 /**
  * Command codes
@@ -33,6 +49,13 @@
 #define CMD_SEND 2
 #define CMD_CONNECT 3
 #define CMD_FETCH_INBOX 4
+#define CMD_SUBSCRIBE 5
+#define CMD_UNSUBSCRIBE 6
+
+#define MAX_EVENTS 64 /* maximum number of ready sockets handled per epoll_wait call */
+#define QUEUE_SIZE 16384 /* messages each queue holds without allocating, more wait in its overflow list */
+#define RECV_SIZE_MIN (BUFFER_SIZE * 4) /* smallest read from a peer connection */
+#define RECV_SIZE_MAX (BUFFER_SIZE * 256) /* largest read from a peer connection, unless a single frame is larger */
 
 /**
  * A command that is recieved from the interface client through the interface server.
@@ -54,21 +77,83 @@ typedef struct {
     char *content;/* pointer to the content bytes of the response which could be a message from another peer or messages from this program to the client */
 } ClientResponse;
 
+/**
+ * An inbound connection from another peer which is being read by the peer listener
+ */
+typedef struct {
+    int fd; /* socket of the connection */
+    Buffer buff; /* bytes received on an interface connection which do not yet add up to a complete command */
+    Uint cap; /* number of bytes allocated for buff.data */
+    SharedFrame *block; /* block a peer connection is received into, complete frames are sliced out of it without copying, NULL before the first read */
+    Uint start; /* offset in block of the first byte which wasn't handed off yet */
+    Uint held; /* number of bytes received into block */
+    Uint read_size; /* bytes asked for by a read, grows while reads come back full and shrinks while they come back mostly empty */
+    Table *streams; /* stream id -> InStream of every stream being received on the connection, NULL until the first one begins */
+    int wake_fd; /* eventfd of the listener reading a peer connection, written to once the next hops of its streams caught up, -1 otherwise */
+    int paused; /* 1 while a next hop of a stream relayed from the connection is backed up, the listener doesn't read it meanwhile */
+} Connection;
+
+/**
+ * What is done with the chunks of a stream being received
+ */
+#define STREAM_RELAY 1 /* chunks are forwarded to the next hops as they arrive */
+#define STREAM_DELIVER 2 /* chunks are gathered into the content of the message, which is delivered to "me" once complete */
+#define STREAM_DISCARD 3 /* the message was already seen or there is no room for it, chunks are dropped */
+
+/**
+ * A streamed message being received on a connection
+ */
+typedef struct {
+    StreamId id; /* id of the stream */
+    Message *msg; /* header of the message, the content is only allocated when the stream is delivered */
+    int mode; /* one of the STREAM_ modes */
+    Uint received; /* content bytes received so far */
+    int n_hops; /* number of peers the stream is relayed to */
+    char (*hops)[PEER_ID_SIZE]; /* ids of the peers the stream is relayed to */
+    Peer **peers; /* entries of the peers the stream is relayed to in the peer table */
+} InStream;
+
+/**
+ * A client connected to the interface port, every client has its own command buffer and its own queue of responses waiting to be sent to it
+ */
+typedef struct {
+    Connection *conn; /* socket of the client and the bytes of its next incomplete command */
+    List *queue; /* responses waiting to be sent to the client, oldest at the bottom */
+    Buffer out; /* encoded response currently being sent, data is NULL if none */
+    Uint out_sent; /* bytes of out already sent */
+    int subscribed; /* 1 if messages delivered to "me" are sent to this client */
+    int closed; /* 1 once the client is gone, it is freed after the events in hand were handled */
+} Session;
+
 /**
  * outbox - queue of messages to send
  * inbox - queue of messages to read, some be not be for "me" so I'll broadcast them to all my neighbors
  * personal_inbox - queue those messages from the inbox that have "me" and the to_peer property of the message
- * message_table - table of messages I've recieved weather for me or not so that I can ignore when i get the same message from multiple sources
- * outbox_mutex, inbox_mutex, message_table_mutex, personal_inbox_mutex - mutexes to handle their respective queues/tables to share among threads
+ * message_table - numbers of messages I've recieved weather for me or not so that I can ignore when i get the same message from multiple sources, sharded so threads seldom wait on each other and forgotten once copies of the message can no longer arrive
+ * next_seq - number of the next message I send, every peer numbers its own messages so the others can tell them apart
+ * work_ready - posted for every message pushed into the inbox or outbox, the workers wait on it
+ * conn_pool - open connections to neighbor peers which messages are sent over
+ * outbox_batcher - messages from the outbox grouped by the neighbor they are sent to, waiting to be written together
+ * udp_sock - UDP socket on the peer port which datagrams from neighbors are received on and sent from
+ * personal_inbox_event - eventfd signaled whenever a response is pushed into the personal inbox, the remote interface waits on it
  * conf - configuration struct with all the config variables interpreted from the config file
  */
-List *outbox, *inbox, *personal_inbox;
-Table *message_table;
-pthread_mutex_t outbox_mutex, inbox_mutex, message_table_mutex, personal_inbox_mutex;
+Queue *outbox, *inbox, *personal_inbox;
+DedupStore *message_table;
+unsigned long long next_seq;
+sem_t work_ready;
+ConnPool *conn_pool;
+Batcher *outbox_batcher;
+int udp_sock;
+int personal_inbox_event;
+Connection udp_marker; /* registered with the listener for the UDP socket so its events can be told apart from those of connections */
+Connection wake_marker; /* registered with the listener for its eventfd, see Connection.wake_fd */
+long long stream_buffered; /* content bytes allocated for streams being delivered to "me", bounded by conf.stream_buffer_limit */
 Config conf;
 
-void server();
-void client();
+int server();
+int client();
+void abort_streams(Connection *conn);
 
 /**
  * Deserializes a commmand from a buffer of bytes
@@ -114,316 +199,1206 @@ Buffer serialize_response(ClientResponse *resp) {
 }
 
 /**
- * Push a message into a given queue
+ * Push a message into a given queue, a worker is woken up to handle it if the queue is the inbox or outbox
  *
- * @param queue_mutex The mutex of the queue to push into
  * @param queue The pointer to the queue
  * @param msg The pointer to the message
  */
-void enqueue_message(pthread_mutex_t *queue_mutex, List *queue, Message *msg) {
-    /* Pretty self-explanatory, check that we can write to queue using the mutex, then write to queue */
-    pthread_mutex_lock(queue_mutex);
-    list_push(queue, msg);
-    pthread_mutex_unlock(queue_mutex);
+void enqueue_message(Queue *queue, Message *msg) {
+    queue_push(queue, msg);
 }
 
 /**
  * Pop a message from a given queue
  *
- * @param queue_mutex The mutex of the queue to pop from
  * @param queue The pointer to the queue
- * @return A pointer to the message poped from queue
+ * @return A pointer to the message poped from queue, or NULL if the queue is empty
  */
-Message* dequeue_message(pthread_mutex_t *queue_mutex, List *queue) {
-    Message *msg;
-    /* Pretty self-explanatory, check that we can write to queue using the mutex, then write to queue */
-    pthread_mutex_lock(queue_mutex);
-    msg = (Message *) list_poplast(queue); /* preforms pop operation but from the back of the queue to achieve the First In First Out order */
-    pthread_mutex_unlock(queue_mutex);
+Message* dequeue_message(Queue *queue) {
+    return (Message *) queue_pop(queue); /* First In First Out order */
+}
+
+/**
+ * Push a response into the personal inbox and wake up the remote interface so it sends the response right away
+ *
+ * @param resp The pointer to the response
+ */
+void push_response(ClientResponse *resp) {
+    uint64_t one;
 
-    return msg;
+    queue_push(personal_inbox, resp);
+
+    one = 1;
+    if (write(personal_inbox_event, &one, sizeof(uint64_t)) < 0) {
+        perror("personal inbox notify failed");
+    }
 }
 
 /**
- * Sends a message to another instance of this program over the internet
+ * Queue a response to be sent to an interface session, the session is marked closed if the client isn't keeping up with its responses
  *
- * @param addr IP address of the other instance
- * @param port Port number the other instance of this program is listening on
- * @param msg Pointer to the message to send
- * @return 1 is there was an error, 0 if sent successfully
+ * @param session Pointer to the session
+ * @param resp The pointer to the response, the session takes ownership of it
  */
-int net_client(char *addr, int port, Message *msg) {
-    int sock;
-    struct sockaddr_in server;
-    Buffer *buff; /* to hold serialized message*/
+void session_push(Session *session, ClientResponse *resp) {
+    if (session->closed || session->queue->size >= (Uint) conf.interface_queue_limit) { /* the limit is at least 1, see load_config */
+        session->closed = 1; /* a client this far behind is dropped rather than buffering for it without bound */
+        free(resp->content);
+        free(resp);
+        return;
+    }
+    list_push(session->queue, resp);
+}
 
-    buff = serialize_msg(msg); /* serialize the message to bytes */
+/**
+ * Makes a copy of a response
+ *
+ * @param resp Pointer to the response
+ * @return Pointer to the new response
+ */
+ClientResponse *copy_response(ClientResponse *resp) {
+    ClientResponse *copy;
 
-    /* Create socket */
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == -1) {
-        printf("failed to create socket\n");
-    }
-    /* Set address and port of target */
-    server.sin_addr.s_addr = inet_addr(addr);
-    server.sin_family = AF_INET;
-    server.sin_port = htons(port);
-
-    /* Connect to target */
-    if (connect(sock, (struct sockaddr *) &server, sizeof(server)) < 0) {
-        perror("connect failed\n");
-        free(buff);
+    copy = malloc(sizeof(ClientResponse));
+    memcpy(copy, resp, sizeof(ClientResponse));
+    copy->content = malloc(resp->content_len);
+    memcpy(copy->content, resp->content, resp->content_len);
+
+    return copy;
+}
+
+/**
+ * Puts a socket into non-blocking mode
+ *
+ * @param fd The socket
+ * @return 1 if there was an error, 0 otherwise
+ */
+int set_nonblocking(int fd) {
+    int flags;
+
+    flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
         return 1;
     }
+    return 0;
+}
+
+/**
+ * Creates the state of a newly accepted inbound connection
+ *
+ * @param fd The socket of the connection
+ * @return Pointer to the new connection
+ */
+Connection *new_connection(int fd) {
+    Connection *conn;
+
+    conn = malloc(sizeof(Connection));
+    conn->fd = fd;
+    conn->buff.data = NULL;
+    conn->buff.len = 0;
+    conn->cap = 0;
+    conn->block = NULL;
+    conn->start = 0;
+    conn->held = 0;
+    conn->read_size = RECV_SIZE_MIN;
+    conn->streams = NULL;
+    conn->wake_fd = -1;
+    conn->paused = 0;
+
+    return conn;
+}
+
+/**
+ * Closes an inbound connection and frees it along with any partially received message
+ *
+ * @param conn Pointer to the connection
+ */
+void close_connection(Connection *conn) {
+    close(conn->fd); /* closing the socket also removes it from the epoll set */
+    if (conn->streams != NULL) { /* streams cut short by the connection closing never complete */
+        abort_streams(conn);
+    }
+    free(conn->buff.data);
+    if (conn->block != NULL) { /* messages sliced out of the block keep it alive until they are done with it */
+        frame_release(conn->block);
+    }
+    free(conn);
+}
+
+/**
+ * Makes sure the receive block of a peer connection has room for more bytes. The block is replaced once the next frame doesn't fit in what's
+ * left of it, it is reused in place if no message points into it anymore, otherwise the start of the next frame is moved to a new block.
+ * A frame larger than a read gets a block of exactly its size and is received straight into it
+ *
+ * @param conn Pointer to the connection
+ */
+void connection_prepare_block(Connection *conn) {
+    FrameHeader hdr;
+    Uint pending, need, cap;
+    SharedFrame *block;
+
+    pending = conn->held - conn->start;
+    need = FRAME_HEADER_SIZE;
+    if (conn->block != NULL &&
+        frame_read_header((char *) conn->block->buff.data + conn->start, pending, conf.max_frame_size, &hdr) > 0) {
+        need = FRAME_HEADER_SIZE + hdr.len; /* the size of the next frame is known from its header */
+    }
+    if (conn->block != NULL && conn->held < conn->block->buff.len && conn->block->buff.len - conn->start >= need) {
+        return;
+    }
+
+    cap = need > conn->read_size ? need : conn->read_size;
+    if (conn->block != NULL && conn->block->buff.len == cap && __atomic_load_n(&conn->block->refs, __ATOMIC_ACQUIRE) == 1) {
+        memmove(conn->block->buff.data, (char *) conn->block->buff.data + conn->start, pending);
+    } else {
+        block = new_shared_frame(NULL, cap);
+        if (conn->block != NULL) {
+            memcpy(block->buff.data, (char *) conn->block->buff.data + conn->start, pending);
+            frame_release(conn->block);
+        }
+        conn->block = block;
+    }
+    conn->start = 0;
+    conn->held = pending;
+}
+
+/**
+ * Makes sure the receive buffer of an interface connection has room for at least BUFFER_SIZE more bytes
+ *
+ * @param conn Pointer to the connection
+ */
+void connection_reserve(Connection *conn) {
+    if (conn->cap - conn->buff.len < BUFFER_SIZE) {
+        conn->cap = conn->cap ? conn->cap * 2 : BUFFER_SIZE * 4;
+        conn->buff.data = realloc(conn->buff.data, conn->cap);
+    }
+}
+
+/**
+ * Hands a message meant for "me" to the interface clients, or prints it to the standard output if there is no interface port
+ *
+ * @param msg Pointer to the message
+ */
+void deliver_message(Message *msg) {
+    char *time_str;
+    ClientResponse *resp;
+
+    if (conf.interface_port) {
+        /* if an interface port is defined, create from a ClientResponse struct from the message to send to the interface client and push it to the personal inbox queue */
+        resp = malloc(sizeof(ClientResponse));
+        resp->time = msg->time;
+        memcpy(resp->from_peer, msg->from_peer, PEER_ID_SIZE);
+        resp->content_len = msg->content.len;
+        resp->content = malloc(resp->content_len);
+        memcpy(resp->content, msg->content.data, resp->content_len);
+
+        push_response(resp);
+
+    } else {
+        /* otherwise, simple print the message to the standart out stream */
+        time_str = miliseconds_to_datestr(msg->time);
+        printf("%.*s> [%s] \"%.*s\"\n", PEER_ID_SIZE, msg->from_peer, time_str, (int) msg->content.len,
+               (char *) msg->content.data);
+        free(time_str);
+    }
+}
 
-    /* Send the serialized message to the target */
-    if (send(sock, buff->data, buff->len, 0) < 0) {
-        printf("send failed\n");
-        free(buff); /* If the message has failed we return 1, therefore we must free the serialized message buffer first to avoid memory leak */
+/**
+ * Marks a message as having passed through here, so it's handled only the first time it arrives
+ *
+ * @param msg Pointer to the message
+ * @return 1 if the message already passed through here or isn't numbered, 0 if this is the first time
+ */
+int message_seen(Message *msg) {
+    if (msg->seq == 0) { /* every peer numbers the messages it sends, one that isn't numbered can't be told apart from its copies and would go around forever */
         return 1;
     }
 
-    close(sock); /* Close the connection properly */
+    return dedup_check_sequence(message_table, msg->from_peer, msg->seq, msg->time); /* a few bits of the window of the origin tell whether it was seen */
+}
+
+/**
+ * Sends a frame of a relayed stream to every next hop of the stream. Chunks never go over UDP since they must arrive in order. A next hop
+ * that fell behind pauses the connection the stream comes in on until it caught up, so a slow next hop slows down the sender instead of
+ * piling up here, and the other connections of the listener are still read meanwhile
+ *
+ * @param conn Pointer to the connection the frame was received on, NULL if there is no point in pausing it
+ * @param s Pointer to the stream
+ * @param frame Pointer to the frame, the caller keeps its reference
+ */
+void stream_forward(Connection *conn, InStream *s, SharedFrame *frame) {
+    int i, slot;
+
+    directory_read_begin(conf.peer_table, &slot); /* the batcher reads the addresses of the next hops, they are only valid while reading */
+    for (i = 0; i < s->n_hops; i++) {
+        batcher_add(outbox_batcher, s->hops[i], s->peers[i], BATCH_NO_DROP, frame_retain(frame));
+    }
+    directory_read_end(conf.peer_table, slot);
+
+    if (conn == NULL || conn->wake_fd < 0) {
+        return;
+    }
+    for (i = 0; i < s->n_hops && !conn->paused; i++) { /* waiting on one of them is enough, the rest is checked again on the next frame */
+        conn->paused = batcher_backlogged(outbox_batcher, s->hops[i], conn->wake_fd);
+    }
+}
+
+/**
+ * Starts receiving a streamed message, decides whether it is relayed, delivered or dropped and forwards the begin frame to the next hops
+ *
+ * @param conn Pointer to the connection the stream is received on
+ * @param msg Pointer to the header of the message, the stream takes ownership of it
+ * @param frame Pointer to the FRAME_STREAM_BEGIN frame
+ * @return Pointer to the new stream
+ */
+InStream *stream_begin(Connection *conn, Message *msg, SharedFrame *frame) {
+    InStream *s;
+    TableIter *it;
+    Table *peers;
+    int slot;
+
+    s = malloc(sizeof(InStream));
+    s->msg = msg;
+    s->received = 0;
+    s->n_hops = 0;
+    s->hops = NULL;
+    s->peers = NULL;
+
+    if (message_seen(msg)) {
+        s->mode = STREAM_DISCARD;
+
+    } else if (strncmp(msg->to_peer, conf.peer_id, PEER_ID_SIZE) == 0) {
+        /* the whole content has to be held before it's delivered, so streams for "me" share a budget */
+        if (__atomic_add_fetch(&stream_buffered, (long long) msg->content.len, __ATOMIC_RELAXED) > conf.stream_buffer_limit) {
+            __atomic_sub_fetch(&stream_buffered, (long long) msg->content.len, __ATOMIC_RELAXED);
+            printf("dropping streamed message of %u bytes from %.*s, stream_buffer_limit reached\n", msg->content.len,
+                   PEER_ID_SIZE, msg->from_peer);
+            s->mode = STREAM_DISCARD;
+        } else {
+            s->mode = STREAM_DELIVER;
+            msg->content.data = malloc(msg->content.len ? msg->content.len : 1);
+        }
+
+    } else {
+        /* just like server() does with whole messages, relay the stream to all "my" neighbors but the one it came from */
+        s->mode = STREAM_RELAY;
+        peers = directory_read_begin(conf.peer_table, &slot);
+        s->hops = malloc(PEER_ID_SIZE * (peers->size + 1));
+        s->peers = malloc(sizeof(Peer *) * (peers->size + 1)); /* peers are never freed, so they outlive the read */
+
+        it = table_iter_new(peers);
+        while (table_iter_next(it)) {
+            if (strncmp((char *) it->curr->key.data, conf.peer_id, PEER_ID_SIZE) != 0 &&
+                strncmp((char *) it->curr->key.data, msg->from_peer, PEER_ID_SIZE) != 0) {
+                memcpy(s->hops[s->n_hops], it->curr->key.data, PEER_ID_SIZE);
+                s->peers[s->n_hops] = (Peer *) it->curr->value.data;
+                s->n_hops++;
+            }
+        }
+        free(it);
+        directory_read_end(conf.peer_table, slot);
+
+        stream_forward(conn, s, frame);
+    }
+
+    return s;
+}
+
+/**
+ * Finishes a stream being received on a connection, a complete delivered stream is handed to "me" and an aborted relayed stream is
+ * aborted at the next hops as well. The stream is removed from the connection and freed
+ *
+ * @param conn Pointer to the connection
+ * @param s Pointer to the stream
+ * @param aborted 1 if the rest of the stream will never come, 0 if it is complete
+ */
+void stream_end(Connection *conn, InStream *s, int aborted) {
+    SharedFrame *frame;
+    Buffer key;
+
+    if (s->mode == STREAM_RELAY && aborted) {
+        frame = stream_abort_frame(s->id);
+        stream_forward(NULL, s, frame);
+        frame_release(frame);
+    } else if (s->mode == STREAM_DELIVER) {
+        if (!aborted) {
+            deliver_message(s->msg);
+        }
+        __atomic_sub_fetch(&stream_buffered, (long long) s->msg->content.len, __ATOMIC_RELAXED);
+    }
+
+    key.len = STREAM_ID_SIZE;
+    key.data = &s->id;
+    table_delete(conn->streams, key);
+
+    free_message(s->msg);
+    free(s->hops);
+    free(s->peers);
+    free(s);
+}
+
+/**
+ * Aborts every stream still being received on a connection and frees the table of streams
+ *
+ * @param conn Pointer to the connection
+ */
+void abort_streams(Connection *conn) {
+    int i, n;
+    InStream **pending;
+    TableIter *it;
+
+    /* collect the streams first, ending a stream removes it from the table being iterated over */
+    pending = malloc(sizeof(InStream *) * (conn->streams->size + 1));
+    n = 0;
+    it = table_iter_new(conn->streams);
+    while (table_iter_next(it)) {
+        pending[n++] = (InStream *) it->curr->value.data;
+    }
+    free(it);
+
+    for (i = 0; i < n; i++) {
+        stream_end(conn, pending[i], 1);
+    }
+    free(pending);
+
+    free_table(conn->streams);
+    conn->streams = NULL;
+}
+
+/**
+ * Handles a stream frame received on a connection
+ *
+ * @param conn Pointer to the connection
+ * @param hdr Pointer to the header of the frame
+ * @param frame Pointer to the whole frame, relayed streams forward it as it is
+ * @return 0 if the frame was handled, -1 if the peer broke the stream protocol
+ */
+int receive_stream_frame(Connection *conn, FrameHeader *hdr, SharedFrame *frame) {
+    StreamId id;
+    Buffer key, value, *lookup;
+    InStream *s;
+    Message *msg;
+    char *payload;
+    Uint len;
+
+    payload = (char *) frame->buff.data + FRAME_HEADER_SIZE;
+    if (stream_read_id(payload, hdr->len, &id)) {
+        return -1;
+    }
+    key.len = STREAM_ID_SIZE;
+    key.data = &id;
+    lookup = conn->streams != NULL ? table_search(conn->streams, key) : NULL;
+    s = lookup != NULL ? (InStream *) lookup->data : NULL;
+
+    if (hdr->type == FRAME_STREAM_BEGIN) {
+        msg = stream_read_begin(payload, hdr->len);
+        if (s != NULL || msg == NULL) { /* the id is already in use on this connection, or the header is garbage */
+            if (msg != NULL) {
+                free_message(msg);
+            }
+            return -1;
+        }
+        s = stream_begin(conn, msg, frame);
+        s->id = id;
+
+        if (conn->streams == NULL) {
+            conn->streams = new_table();
+        }
+        value.len = sizeof(InStream);
+        value.data = s;
+        table_insert(conn->streams, key, value);
+
+        if (msg->content.len == 0) {
+            stream_end(conn, s, 0);
+        }
+        return 0;
+    }
+
+    if (s == NULL) { /* the rest of a stream whose beginning we never got, nothing can be done with it */
+        return 0;
+    }
+
+    if (hdr->type == FRAME_STREAM_CHUNK) {
+        len = hdr->len - STREAM_ID_SIZE;
+        if (len > s->msg->content.len - s->received) { /* more content than the stream announced */
+            return -1;
+        }
+
+        if (s->mode == STREAM_RELAY) {
+            stream_forward(conn, s, frame);
+        } else if (s->mode == STREAM_DELIVER) {
+            memcpy((char *) s->msg->content.data + s->received, payload + STREAM_ID_SIZE, len);
+        }
+        s->received += len;
+
+        if (s->received == s->msg->content.len) {
+            stream_end(conn, s, 0);
+        }
+    } else { /* FRAME_STREAM_ABORT */
+        stream_end(conn, s, 1);
+    }
 
-    free(buff); /* free the serialized message buffer */
     return 0;
 }
 
 /**
- * Thread function that listens on the configured port for messages from other instances of this program
+ * Pushes every message whose frame is complete in the receive block of a peer connection into the inbox, the bytes of the next incomplete
+ * frame stay in the block
  *
- * @param vargp Standard thread program argument pointer
- * @return Never
+ * @param conn Pointer to the connection
+ * @return Number of messages pushed into the inbox, or -1 if the peer broke the framing protocol
  */
-void *net_server(void *vargp) {
-    int listenfd, client_sock;
+int consume_frames(Connection *conn) {
+    Uint offset;
+    int count, res, broken;
+    FrameHeader hdr;
+    SharedFrame *frame;
+    Message *msg;
+
+    /* hand off every frame whose bytes are complete, the length of each one is known from its header */
+    count = 0;
+    offset = conn->start;
+    while ((res = frame_read_header((char *) conn->block->buff.data + offset, conn->held - offset, conf.max_frame_size, &hdr)) > 0 &&
+           FRAME_HEADER_SIZE + hdr.len <= conn->held - offset) {
+        if (hdr.type == FRAME_MSG || hdr.type == FRAME_STREAM_BEGIN || hdr.type == FRAME_STREAM_CHUNK || hdr.type == FRAME_STREAM_ABORT) {
+            /* the frame is kept whole where it was received, the message points into it and relaying the message sends these same bytes on */
+            frame = frame_slice(conn->block, offset, FRAME_HEADER_SIZE + hdr.len);
+            broken = 0;
+            if (hdr.type == FRAME_MSG) {
+                msg = unframe_msg(frame, hdr.len);
+                if (msg != NULL) {
+                    enqueue_message(inbox, msg);
+                    count++;
+                }
+                broken = msg == NULL;
+            } else {
+                broken = receive_stream_frame(conn, &hdr, frame) < 0;
+            }
+            frame_release(frame);
+            if (broken) { /* the peer sent garbage, there is no telling where the next frame starts */
+                return -1;
+            }
+        } /* frames of types we don't know are skipped */
+
+        offset += FRAME_HEADER_SIZE + hdr.len;
+    }
+    conn->start = offset;
+    if (res < 0) {
+        return -1;
+    }
+
+    return count;
+}
+
+/**
+ * Receives every datagram waiting on the UDP socket and pushes the message each one carries into the inbox, a datagram holds exactly one frame
+ *
+ * @param r Pointer to the buffers to receive into
+ * @return Number of messages pushed into the inbox
+ */
+int consume_datagrams(UdpReceiver *r) {
+    int i, n, count;
+    char *dgram;
+    Uint len;
+    FrameHeader hdr;
+    SharedFrame *frame;
+    Message *msg;
+
+    count = 0;
+    while ((n = udp_receive(udp_sock, r)) > 0) {
+        for (i = 0; i < n; i++) {
+            dgram = udp_datagram(r, i);
+            len = r->msgs[i].msg_len;
+            /* a datagram that was truncated or doesn't hold one whole frame is dropped, just like a lost one */
+            if ((r->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) || frame_read_header(dgram, len, conf.max_frame_size, &hdr) <= 0 ||
+                FRAME_HEADER_SIZE + hdr.len != len || hdr.type != FRAME_MSG) {
+                continue;
+            }
+            frame = new_shared_frame(dgram, len);
+            msg = unframe_msg(frame, hdr.len);
+            frame_release(frame);
+            if (msg != NULL) {
+                enqueue_message(inbox, msg);
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Accounts for bytes read into the receive block of a peer connection and hands off every frame they completed
+ *
+ * @param conn Pointer to the connection
+ * @param n Number of bytes read, into the free space of the block as prepared by connection_prepare_block
+ * @return Number of messages pushed into the inbox, or -1 if the peer broke the framing protocol
+ */
+int connection_received(Connection *conn, Uint n) {
+    Uint asked;
+
+    asked = conn->block->buff.len - conn->held;
+    conn->held += n;
+    if (n == asked && asked >= conn->read_size / 2 && conn->read_size < RECV_SIZE_MAX) {
+        conn->read_size *= 2; /* more was waiting, ask for more at once next time */
+    } else if (n < asked / 8 && conn->read_size > RECV_SIZE_MIN) {
+        conn->read_size /= 2;
+    }
+
+    return consume_frames(conn);
+}
+
+/**
+ * Reads everything currently available on an inbound connection and pushes every message that was completed by those bytes into the inbox.
+ * Reading stops early once the connection is paused, see stream_forward
+ *
+ * @param conn Pointer to the connection
+ * @return Number of messages pushed into the inbox, or -1 if the connection was closed by the peer, failed or broke the framing protocol
+ */
+int read_connection(Connection *conn) {
     long read_size;
-    struct sockaddr_in serv_addr;
-    char buff[BUFFER_SIZE]; /* buffer to recieve bytes into */
-    Buffer *tmp, *total_buff; /* total_buff - to hold the accumulated bytes recieved from the connection */
-    List *buff_chain; /* chain of buffers accumulated in the recieve loop */
-    Message *msg; /* message recieved from deserializing the accumulated buffers */
+    int count, res;
+
+    count = 0;
+    while (1) {
+        connection_prepare_block(conn);
 
-    listenfd = socket(AF_INET, SOCK_STREAM, 0); /* Create socket */
-    /* Set port and address*/
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serv_addr.sin_port = htons(conf.port);
+        read_size = recv(conn->fd, (char *) conn->block->buff.data + conn->held, conn->block->buff.len - conn->held, 0);
+        if (read_size == 0) { /* peer closed the connection */
+            return -1;
+        }
+        if (read_size < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { /* we drained the socket, wait for the next readiness notification */
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        res = connection_received(conn, read_size);
+        if (res < 0) {
+            return -1;
+        }
+        count += res;
+        if (conn->paused) { /* a next hop of a stream on the connection is backed up, the rest waits in the socket */
+            break;
+        }
+    }
 
-    bind(listenfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr));
+    return count;
+}
+
+/**
+ * Accepts every pending connection on the listening socket and registers it with the epoll instance
+ *
+ * @param epfd The epoll instance
+ * @param listenfd The listening socket
+ * @param wake_fd eventfd of the listener, see Connection.wake_fd
+ */
+void accept_connections(int epfd, int listenfd, int wake_fd) {
+    int client_sock;
+    Connection *conn;
+    struct epoll_event ev;
+
+    while ((client_sock = accept(listenfd, (struct sockaddr *) NULL, NULL)) >= 0) {
+        if (set_nonblocking(client_sock)) {
+            close(client_sock);
+            continue;
+        }
+        conn = new_connection(client_sock);
+        conn->wake_fd = wake_fd;
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, client_sock, &ev) < 0) {
+            perror("epoll_ctl failed\n");
+            close_connection(conn);
+        }
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+        perror("accept failed\n");
+    }
+}
+
+/**
+ * Creates the socket the peer listener accepts connections from other instances on. With several listeners every one of them binds a
+ * socket of its own to the peer port and the kernel spreads incoming connections across them
+ *
+ * @return The listening socket or -1 if there was an error
+ */
+int open_listener() {
+    int listenfd, opt;
+    struct sockaddr_in serv_addr;
+    struct sockaddr_in6 serv_addr6;
+    struct sockaddr *addr;
+    socklen_t addr_len;
+
+    listenfd = socket(AF_INET6, SOCK_STREAM, 0); /* Create socket, IPv6 accepts IPv4 peers as well */
+    if (listenfd >= 0) {
+        opt = 0;
+        setsockopt(listenfd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt));
+        memset(&serv_addr6, 0, sizeof(serv_addr6));
+        serv_addr6.sin6_family = AF_INET6;
+        serv_addr6.sin6_addr = in6addr_any;
+        serv_addr6.sin6_port = htons(conf.port);
+        addr = (struct sockaddr *) &serv_addr6;
+        addr_len = sizeof(serv_addr6);
+    } else { /* no IPv6 on this host */
+        listenfd = socket(AF_INET, SOCK_STREAM, 0);
+        /* Set port and address*/
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        serv_addr.sin_port = htons(conf.port);
+        addr = (struct sockaddr *) &serv_addr;
+        addr_len = sizeof(serv_addr);
+    }
+    opt = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)); /* allow a restarted instance to bind while old connections linger in TIME_WAIT */
+    if (conf.listeners > 1 && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        perror("failed to set SO_REUSEPORT\n");
+        close(listenfd);
+        return -1;
+    }
+
+    if (bind(listenfd, addr, addr_len) == -1) {
+        perror("failed to bind\n");
+        close(listenfd);
+        return -1;
+    }
 
     /* listen on socket */
-    if (listen(listenfd, 10) == -1) {
+    if (listen(listenfd, conf.listen_backlog) == -1) {
         printf("failed to listen\n");
-        return NULL;
+        close(listenfd);
+        return -1;
+    }
+
+    return listenfd;
+}
+
+/**
+ * Resets the eventfd of a listener before it resumes the connections it paused, so a next hop catching up meanwhile wakes it up again
+ *
+ * @param wake_fd eventfd of the listener
+ */
+void reset_wake(int wake_fd) {
+    uint64_t counter;
+
+    if (read(wake_fd, &counter, sizeof(uint64_t)) < 0 && errno != EAGAIN) {
+        perror("listener wake up failed");
+    }
+}
+
+/**
+ * Registers the connections an epoll listener paused with the epoll instance again. A connection whose next hop is still backed up is
+ * paused again by the next chunk read from it
+ *
+ * @param epfd The epoll instance
+ * @param paused List of the paused connections, emptied
+ */
+void resume_connections(int epfd, List *paused) {
+    Connection *conn;
+    struct epoll_event ev;
+
+    while ((conn = (Connection *) list_pop(paused)) != NULL) {
+        conn->paused = 0;
+        ev.events = EPOLLIN; /* level triggered, so whatever waited in the socket is reported right away */
+        ev.data.ptr = conn;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+            perror("epoll_ctl failed\n");
+            close_connection(conn);
+        }
     }
+}
+
+/**
+ * Runs the peer listener with epoll, all inbound connections are multiplexed so a slow peer doesn't hold up the others
+ *
+ * @param listenfd The listening socket
+ * @param udp 1 if this listener receives the datagrams on the UDP socket as well
+ */
+void net_server_epoll(int listenfd, int udp) {
+    int epfd, wake_fd, i, n;
+    struct epoll_event ev, events[MAX_EVENTS];
+    Connection *conn;
+    UdpReceiver *receiver;
+    List *paused;
+
+    epfd = epoll_create1(0);
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (epfd < 0 || wake_fd < 0 || set_nonblocking(listenfd)) {
+        perror("epoll_create failed\n");
+        return;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* the listening socket is the only one registered without a connection */
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+    if (udp && udp_sock >= 0) {
+        ev.data.ptr = &udp_marker;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, udp_sock, &ev);
+    }
+    ev.data.ptr = &wake_marker;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &ev);
+    receiver = new_udp_receiver();
+    paused = new_list(); /* connections taken out of the epoll set until the next hops of their streams caught up */
 
     while (1) {
-        client_sock = accept(listenfd, (struct sockaddr *) NULL, NULL); /* Accept an incoming connection */
-        if (client_sock < 0) {
-            perror("accept failed\n");
-            return NULL;
+        n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed\n");
+            return;
         }
 
-        /* Init buffers form accumulating recieved bytes */
-        total_buff = (Buffer *) malloc(sizeof(Buffer));
-        total_buff->len = 0;
-        buff_chain = new_list();
-        while ((read_size = recv(client_sock, buff, BUFFER_SIZE, 0)) > 0) {/* Recieve bytes from connection */
-            tmp = malloc(sizeof (Buffer));
-            tmp->len = read_size;
-            tmp->data = malloc(read_size);
-            memcpy(tmp->data, buff, read_size);
-            list_push(buff_chain, tmp); /* add recieved buffer to the buffer chain */
-            total_buff->len += read_size;
+        for (i = 0; i < n; i++) {
+            conn = (Connection *) events[i].data.ptr;
+            if (conn == NULL) {
+                accept_connections(epfd, listenfd, wake_fd);
+
+            } else if (conn == &udp_marker) {
+                consume_datagrams(receiver);
+
+            } else if (conn == &wake_marker) { /* next hops caught up, read the paused connections again */
+                reset_wake(wake_fd);
+                resume_connections(epfd, paused);
+
+            } else if (read_connection(conn) < 0) { /* pushes complete messages into the inbox as it reads */
+                close_connection(conn);
+
+            } else if (conn->paused) { /* a paused connection is only closed once it's read again, so it can't be freed while in the list */
+                epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+                list_push(paused, conn);
+            }
+        }
+
+    }
+}
+
+#ifdef HAVE_IO_URING
+/**
+ * Queues an accept on the listening socket, its completion is tagged with a NULL connection
+ *
+ * @param ring Pointer to the ring
+ * @param listenfd The listening socket
+ */
+void uring_prep_accept(Uring *ring, int listenfd) {
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->user_data = 0;
+}
+
+/**
+ * Queues a receive into the free space of the receive block of a connection, its completion is tagged with the connection
+ *
+ * @param ring Pointer to the ring
+ * @param conn Pointer to the connection
+ */
+void uring_prep_recv(Uring *ring, Connection *conn) {
+    struct io_uring_sqe *sqe;
+
+    connection_prepare_block(conn);
+    sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->addr = (unsigned long) ((char *) conn->block->buff.data + conn->held);
+    sqe->len = conn->block->buff.len - conn->held;
+    sqe->user_data = (unsigned long) conn;
+}
+
+/**
+ * Queues a wait for datagrams on the UDP socket, its completion is tagged with the UDP marker
+ *
+ * @param ring Pointer to the ring
+ */
+void uring_prep_poll_udp(Uring *ring) {
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = udp_sock;
+    sqe->poll_events = POLLIN;
+    sqe->user_data = (unsigned long) &udp_marker;
+}
+
+/**
+ * Queues a wait for the eventfd of the listener, its completion is tagged with the wake marker
+ *
+ * @param ring Pointer to the ring
+ * @param wake_fd eventfd of the listener
+ */
+void uring_prep_poll_wake(Uring *ring, int wake_fd) {
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wake_fd;
+    sqe->poll_events = POLLIN;
+    sqe->user_data = (unsigned long) &wake_marker;
+}
+
+/**
+ * Runs the peer listener with io_uring, there is always one accept and one receive per connection in flight, except for paused
+ * connections, and everything that was queued while handling completions is submitted with a single system call
+ *
+ * @param listenfd The listening socket
+ * @param udp 1 if this listener receives the datagrams on the UDP socket as well
+ * @param ring Pointer to the ring
+ */
+void net_server_uring(int listenfd, int udp, Uring *ring) {
+    struct io_uring_cqe *cqe;
+    Connection *conn;
+    UdpReceiver *receiver;
+    List *paused;
+    int res, wake_fd;
+
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (wake_fd < 0) {
+        perror("eventfd failed\n");
+        return;
+    }
+    uring_prep_accept(ring, listenfd);
+    if (udp && udp_sock >= 0) {
+        uring_prep_poll_udp(ring);
+    }
+    uring_prep_poll_wake(ring, wake_fd);
+    receiver = new_udp_receiver();
+    paused = new_list(); /* connections with no receive in flight until the next hops of their streams caught up */
+
+    while (1) {
+        if (uring_submit_and_wait(ring, 1, -1) < 0) {
+            perror("io_uring_enter failed\n");
+            return;
         }
-        total_buff->data = consume_buff_chain(buff_chain, total_buff->len); /* turn buffer chain into one large buffer */
-        msg = deserialize_msg(total_buff->data); /* deserialize that large buffer into a message struct */
 
-        enqueue_message(&inbox_mutex, inbox, msg); /* push the message into the inbox */
+        while ((cqe = uring_peek_cqe(ring)) != NULL) {
+            conn = (Connection *) (unsigned long) cqe->user_data;
+            res = cqe->res;
+            uring_cqe_seen(ring);
+
+            if (conn == NULL) { /* an accept completed, queue the first receive of the connection and the next accept */
+                if (res >= 0) {
+                    conn = new_connection(res);
+                    conn->wake_fd = wake_fd;
+                    uring_prep_recv(ring, conn);
+                } else if (res != -EINTR && res != -ECONNABORTED && res != -EAGAIN) {
+                    errno = -res;
+                    perror("accept failed\n");
+                }
+                uring_prep_accept(ring, listenfd);
+
+            } else if (conn == &udp_marker) { /* datagrams are waiting, the socket is non-blocking so read them all directly and wait again */
+                consume_datagrams(receiver);
+                uring_prep_poll_udp(ring);
+
+            } else if (conn == &wake_marker) { /* next hops caught up, receive on the paused connections again */
+                reset_wake(wake_fd);
+                while ((conn = (Connection *) list_pop(paused)) != NULL) {
+                    conn->paused = 0;
+                    uring_prep_recv(ring, conn);
+                }
+                uring_prep_poll_wake(ring, wake_fd);
+
+            } else if (res <= 0) { /* peer closed the connection or it failed */
+                if (res == -EINTR || res == -EAGAIN) {
+                    uring_prep_recv(ring, conn);
+                } else {
+                    close_connection(conn);
+                }
 
-        server(); /* trigger the handeling of messages in the inbox */
+            } else {
+                if (connection_received(conn, res) < 0) { /* pushes complete messages into the inbox */
+                    close_connection(conn);
+                } else if (conn->paused) { /* no receive is queued until the next hop it waits for caught up */
+                    list_push(paused, conn);
+                } else {
+                    uring_prep_recv(ring, conn);
+                }
+            }
+        }
 
-        free_buffer(total_buff); /* free the total buffer */
-        memset(buff, 0, BUFFER_SIZE); /* zero the recieve buffer */
-        close(client_sock); /* close connection */
     }
+}
+#endif
 
+/**
+ * Handles messages from the outbox and the inbox in turn until both are empty or the work budget is spent. Handling a message only ever
+ * queues the messages it leads to, which are handled by later turns of the loop, so the stack stays flat however much traffic comes in.
+ * Messages left over when the budget is spent still have their posts on the work semaphore, so they are picked up by the next wake up of
+ * this or another worker instead of one worker draining a burst while the others sleep
+ */
+void dispatch() {
+    int handled, progress;
+
+    handled = 0;
+    do {
+        progress = client(); /* messages the interface asked to send and messages on their way to a neighbor */
+        progress += server(); /* messages received from neighbors and messages whose target isn't a neighbor */
+        handled += progress;
+    } while (progress > 0 && handled < conf.dispatch_budget);
+
+    if (progress > 0) { /* stopped on the budget, make sure a worker comes back for the rest even if its posts were taken by early wake ups */
+        sem_post(&work_ready);
+    }
+}
+
+/**
+ * Thread function that handles the messages in the inbox and outbox whenever it is woken up, several of these run side by side
+ *
+ * @param vargp Standard thread program argument pointer
+ * @return Never
+ */
+void *worker(void *vargp) {
+    while (1) {
+        if (sem_wait(&work_ready) < 0) { /* interrupted, the queues are worth a look anyway */
+            continue;
+        }
+
+        dispatch();
+    }
+}
+
+/**
+ * Thread function that sends the messages the workers queued for the neighbors, several of these run side by side
+ *
+ * @param vargp Standard thread program argument pointer
+ * @return Never
+ */
+void *sender(void *vargp) {
+    batcher_run(outbox_batcher, conn_pool);
     return NULL;
 }
 
 /**
- * Handles the messages in the outbox queue
+ * Pins the calling thread to a CPU, the CPUs online are taken in turn
+ *
+ * @param index Index of the thread among the threads pinned
  */
-void client() {
+void pin_to_cpu(int index) {
+    cpu_set_t cpus;
+    long n_cpus;
+
+    n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_cpus < 1) {
+        return;
+    }
+    CPU_ZERO(&cpus);
+    CPU_SET(index % n_cpus, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        printf("failed to pin listener %d to a CPU\n", index);
+    }
+}
+
+/**
+ * Thread function that listens on the configured port for messages from other instances of this program, a connection may carry any number of messages.
+ * Uses io_uring when it is configured and available, otherwise epoll. Several of these may run side by side, each with its own listening
+ * socket and connections, the first one also receives the datagrams on the UDP socket
+ *
+ * @param vargp Index of the listener cast to a pointer
+ * @return Never
+ */
+void *net_server(void *vargp) {
+    int listenfd, index;
+#ifdef HAVE_IO_URING
+    Uring ring;
+#endif
+
+    index = (int) (long) vargp;
+    if (conf.pin_listeners) {
+        pin_to_cpu(index);
+    }
+
+    listenfd = open_listener();
+    if (listenfd < 0) {
+        return NULL;
+    }
+
+#ifdef HAVE_IO_URING
+    if (conf.io_backend == IO_BACKEND_URING) {
+        if (uring_init(&ring, URING_ENTRIES) == 0) {
+            net_server_uring(listenfd, index == 0, &ring);
+            uring_exit(&ring);
+            return NULL;
+        }
+        printf("io_uring is not available, falling back to epoll\n");
+    }
+#endif
+    net_server_epoll(listenfd, index == 0);
+
+    return NULL;
+}
+
+/**
+ * Queues a message to be sent to a neighbor, content larger than the stream threshold is split into a stream so neither side ever has to
+ * hold a frame of that size in one piece
+ *
+ * @param peer_id Id of the neighbor
+ * @param peer Pointer to the entry of the neighbor in the peer table
+ * @param udp 1 if the message should go over UDP, streams always go over TCP
+ * @param msg Pointer to the message
+ */
+void batch_message(char *peer_id, Peer *peer, int udp, Message *msg) {
+    int n;
+    SharedFrame *frame, **frames;
+
+    frame = frame_msg(msg);
+    if (msg->content.len <= conf.stream_threshold) {
+        batcher_add(outbox_batcher, peer_id, peer, udp ? BATCH_UDP : 0, frame); /* queue the message for the target, the senders send it along with the other messages to the same target */
+        return;
+    }
+
+    frames = stream_split(frame, stream_id_of(msg), conf.stream_chunk_size, &n); /* every neighbor gets the stream under the same id */
+    frame_release(frame); /* the chunks hold their own references to it */
+    batcher_add_many(outbox_batcher, peer_id, peer, BATCH_NO_DROP, frames, n); /* a stream is queued whole and in one piece, dropping part of it would waste the rest */
+    free(frames);
+}
+
+/**
+ * Handles the message at the front of the outbox queue
+ *
+ * @return 1 if a message was handled, 0 if the outbox was empty
+ */
+int client() {
     /* Variables to hold various temporary data */
-    int i, port;
-    char addr[BUFFER_SIZE], *tmp;
+    int udp, slot;
     Message *msg;
-    Buffer peer_req_data, *tmp_buf, tmp_peer_id;
-
-    do {
-        tmp = NULL;
-        msg = NULL;
-        peer_req_data.len = 0;
-        peer_req_data.data = NULL;
+    Peer *peer;
+    Buffer tmp_peer_id;
 
-        msg = dequeue_message(&outbox_mutex, outbox); /* pop a message from the outbox queue */
+    msg = dequeue_message(outbox); /* pop a message from the outbox queue */
+    if (msg == NULL) {
+        return 0;
+    }
 
-        if (msg != NULL) { /* If indeed a message was poped from the queue */
-            if (msg->through_peer[0]) { /* Check if the message has a through peer defined, since through peer buffer is zeroed by default, it is enough to check the first byte */
-                tmp_peer_id = buffer_from_str(msg->through_peer,
-                                              PEER_ID_SIZE); /* set peer id to look for in peer table to the through peer of the message*/
-            } else {
-                tmp_peer_id = buffer_from_str(msg->to_peer,
-                                              PEER_ID_SIZE); /* otherwise, set peer id to look for in peer table to the to peer of the message*/
-            }
+    if (msg->through_peer[0]) { /* Check if the message has a through peer defined, since through peer buffer is zeroed by default, it is enough to check the first byte */
+        tmp_peer_id = buffer_from_str(msg->through_peer,
+                                      PEER_ID_SIZE); /* set peer id to look for in peer table to the through peer of the message*/
+    } else {
+        tmp_peer_id = buffer_from_str(msg->to_peer,
+                                      PEER_ID_SIZE); /* otherwise, set peer id to look for in peer table to the to peer of the message*/
+    }
 
-            tmp_buf = table_search(conf.peer_table, tmp_peer_id); /* search for target peer in the peer table */
+    /* the read lasts until the address of the peer is copied into its batch */
+    peer = peer_table_search(directory_read_begin(conf.peer_table, &slot), tmp_peer_id); /* search for target peer in the peer table */
 
-            if (tmp_buf != NULL) {
-                /* if the target peer was found in the peer table, parse his IP and port from the peer table search result and send the message */
-                tmp = (char *) tmp_buf->data; /* address is stored as xxxx.xxxx.xxxx.xxxx:ppppppp therefore we collect all characters before : to the IP address string and all characters after to the port number*/
-                for (i = 0; tmp[i] != 0; i++) {
-                    if (tmp[i] == ':') {
-                        tmp = tmp + i + 1;
-                        addr[i] = 0;
-                        break;
-                    }
-                    addr[i] = tmp[i];
-                }
-                port = atoi(tmp);
-                net_client(addr, port, msg); /* send the message to the target */
-                free_message(msg); /* free the message since it's not going back into any queue */
+    if (peer != NULL) {
+        /* if the target peer was found in the peer table, send the message to the address it was resolved to when it was added */
+        udp = peer_address(peer)->transport == PEER_TRANSPORT_UDP ||
+              (conf.transport == TRANSPORT_UDP && peer_address(peer)->transport == PEER_TRANSPORT_DEFAULT);
+        batch_message((char *) tmp_peer_id.data, peer, udp, msg);
+        directory_read_end(conf.peer_table, slot);
+        free_message(msg); /* free the message since it's not going back into any queue */
 
-            } else { /*Otherwise, we want to broadcast the message to all our neighbors (meaning all peers in our peer table). We do this by artificially inserting the message
+    } else { /*Otherwise, we want to broadcast the message to all our neighbors (meaning all peers in our peer table). We do this by artificially inserting the message
  * into our inbox which will cause the server function to broadcast it since we know that the peer is not found in the peer table*/
-                enqueue_message(&inbox_mutex, inbox, msg);
-                server();/* trigger the handling of the inbox queue */
-            }
+        directory_read_end(conf.peer_table, slot);
+        enqueue_message(inbox, msg); /* handled by a later turn of the dispatch loop */
+    }
+    free(tmp_peer_id.data);
 
-        }
-    } while (msg != NULL);
+    return 1;
 }
 
 /**
- * Handles messages in the inbox queue
+ * Handles the message at the front of the inbox queue
+ *
+ * @return 1 if a message was handled, 0 if the inbox was empty
  */
-void server() {
+int server() {
     /* Variables to hold various temporary data */
     Message *msg, *discover_msg, *broadcast_msg;
     TableIter *it;
     DeserializeTableIter *de_it;
     Buffer *table_buf;
-    Buffer sgn, *lookup, new_buf;
-    char *time_str;
-    ClientResponse *resp;
+    int slot;
 
-    do {
-        msg = dequeue_message(&inbox_mutex, inbox);/* pop a message from the outbox queue */
+    msg = dequeue_message(inbox);/* pop a message from the inbox queue */
+    if (msg == NULL) {
+        return 0;
+    }
 
-        if (msg != NULL) { /* If a message exists check if it's a discover message */
-            if (strncmp(msg->from_peer, "discover", PEER_ID_SIZE) == 0) {
-                /* If the message is delivering a neightbors peer table, deserialize the table iteratively, use the deserialize_table_iter
-                 * to iterate over the message content buffer where in each iterating a key value pair is returned for the buffers bytes */
-                de_it = deserialize_table_iter(&msg->content);
+    /* check if it's a discover message */
+    if (strncmp(msg->from_peer, "discover", PEER_ID_SIZE) == 0) {
+        /* If the message is delivering a neightbors peer table, deserialize the table iteratively, use the deserialize_table_iter
+         * to iterate over the message content buffer where in each iterating a key value pair is returned for the buffers bytes */
+        de_it = deserialize_table_iter(&msg->content);
 
-                while (deserialize_table_iter_next(de_it)) { /* while there are still key value pairs in the buffer */
-                    table_insert(conf.peer_table, de_it->curr->key,
-                                 de_it->curr->value); /* insert them into the peer table */
-                }
-                /* free everything since we are done handling the message */
-                free(de_it);
-                de_it = NULL;
-                free_message(msg);
-
-            } else if (strncmp(msg->to_peer, "discover", PEER_ID_SIZE) == 0) {
-                /* If the message is requesting the peer table, serizlize the peer table, put in the content buffer of a new mesage and push it into the outbox queue*/
-                table_buf = serialize_table(conf.peer_table);
-                discover_msg = new_message(table_buf, "discover", msg->from_peer);
+        directory_write_begin(conf.peer_table);
+        while (deserialize_table_iter_next(de_it)) { /* while there are still key value pairs in the buffer */
+            directory_insert(conf.peer_table, de_it->curr->key, (char *) de_it->curr->value.data,
+                             de_it->curr->value.len); /* insert them into the peer table, the address is parsed and copied */
+        }
+        directory_write_end(conf.peer_table); /* routing sees every peer of the neighbor at once */
+        /* free everything since we are done handling the message */
+        if (de_it->curr != NULL) {
+            free(de_it->curr->key.data);
+            free(de_it->curr->value.data);
+            free(de_it->curr);
+        }
+        free(de_it);
+        de_it = NULL;
+        free_message(msg);
+
+    } else if (strncmp(msg->to_peer, "discover", PEER_ID_SIZE) == 0) {
+        /* If the message is requesting the peer table, serizlize the peer table, put in the content buffer of a new mesage and push it into the outbox queue*/
+        table_buf = serialize_peer_table(directory_read_begin(conf.peer_table, &slot));
+        directory_read_end(conf.peer_table, slot);
+        discover_msg = new_message(table_buf, "discover", msg->from_peer);
+
+        enqueue_message(outbox, discover_msg); /* sent by a later turn of the dispatch loop */
+        /* free the used memory */
+        free_buffer(table_buf);
+        free_message(msg);
 
-                enqueue_message(&outbox_mutex, outbox, discover_msg);
+    } else {
 
-                client();/* invoke the handling of the outbox queue */
-                /* free the used memory */
-                free_buffer(table_buf);
-                free_message(msg);
+        if (!message_seen(msg)) { /* check if the message already passed through here, if it has not, handle the message */
+            if (strncmp(msg->to_peer, conf.peer_id, PEER_ID_SIZE) ==
+                0) { /* check if the message is meant for "me", if it is, deliver it */
+                deliver_message(msg);
 
             } else {
-
-                sgn = gen_message_signature(
-                        msg); /* generate message signature from message which uniquely identifies the message with a fixed amount of bytes */
-                lookup = table_search(message_table,
-                                      sgn); /* check is the message is already present in the message table meaning it already passed through here */
-
-                if (lookup == NULL) {
-                    /* if it has not passed through here, handle the message */
-                    new_buf.data = NULL;
-                    new_buf.len = 0;
-                    table_insert(message_table, sgn,
-                                 new_buf);/* first mark the message as having passed through here by inserting it into the messages table */
-
-                    if (strncmp(msg->to_peer, conf.peer_id, PEER_ID_SIZE) ==
-                        0) { /* check if the message is meant for "me", if it is, */
-
-                        if (conf.interface_port) {
-                            /* if an interface port is defined, create from a ClientResponse struct from the message to send to the interface client and push it to the personal inbox queue */
-                            resp = malloc(sizeof(ClientResponse));
-                            resp->time = msg->time;
-                            memcpy(resp->from_peer, msg->from_peer, PEER_ID_SIZE);
-                            resp->content_len = msg->content.len;
-                            resp->content = malloc(resp->content_len);
-                            memcpy(resp->content, msg->content.data, resp->content_len);
-
-                            pthread_mutex_lock(&personal_inbox_mutex);
-                            list_push(personal_inbox, resp);
-                            pthread_mutex_unlock(&personal_inbox_mutex);
-
-                        } else {
-                            /* otherwise, simple print the message to the standart out stream */
-                            time_str = miliseconds_to_datestr(msg->time);
-                            printf("%.*s> [%s] \"%s\"\n", PEER_ID_SIZE, msg->from_peer, time_str,
-                                   (char *) msg->content.data);
-                            free(time_str);
-                        }
-
-                    } else {
-                        /*Otherwise, if the message is not meant for "me", broadcast the message to all "my" neighbors */
-                        it = table_iter_new(conf.peer_table);
-
-                        while (table_iter_next(
-                                it)) { /* iterate over every peer in the peer table and send the message to through that peer by adding a through peer buffer with that peer's id to copy of the orignal message*/
-                            if (strncmp((char *) it->curr->key.data, conf.peer_id, PEER_ID_SIZE) != 0 &&
-                                strncmp((char *) it->curr->key.data, msg->from_peer, PEER_ID_SIZE) != 0) {
-                                broadcast_msg = new_message(&msg->content, msg->from_peer, msg->to_peer);
-                                memcpy(broadcast_msg->through_peer, it->curr->key.data, PEER_ID_SIZE);
-                                broadcast_msg->time = msg->time;
-                                enqueue_message(&outbox_mutex, outbox, broadcast_msg);
-                            }
-                        }
-                        /* invoke handling the outbox */
-                        client();
-
-                        free(it);
-                        it = NULL;
+                /*Otherwise, if the message is not meant for "me", broadcast the message to all "my" neighbors */
+                it = table_iter_new(directory_read_begin(conf.peer_table, &slot));
+
+                while (table_iter_next(
+                        it)) { /* iterate over every peer in the peer table and send the message to through that peer by adding a through peer buffer with that peer's id to copy of the orignal message*/
+                    if (strncmp((char *) it->curr->key.data, conf.peer_id, PEER_ID_SIZE) != 0 &&
+                        strncmp((char *) it->curr->key.data, msg->from_peer, PEER_ID_SIZE) != 0) {
+                        broadcast_msg = share_msg(msg); /* every copy sends the frame the message came in, the content is never copied */
+                        memcpy(broadcast_msg->through_peer, it->curr->key.data, PEER_ID_SIZE);
+                        enqueue_message(outbox, broadcast_msg); /* the copies are sent by later turns of the dispatch loop */
                     }
                 }
-                /* once the message is handled, free it */
-                free_message(msg);
-                free(sgn.data);
+                directory_read_end(conf.peer_table, slot);
+
+                free(it);
+                it = NULL;
             }
         }
-    } while(msg != NULL);
+        /* once the message is handled, free it */
+        free_message(msg);
+    }
+
+    return 1;
 }
 
 /**
- * Execute a command received from the interface client
+ * Execute a command received from an interface client
  *
  * @param cmd The command struct to execute
+ * @param session The session of the client that sent the command, the reply is sent to it alone
  */
-void execute_command(Command cmd) {
+void execute_command(Command cmd, Session *session) {
     /* Variables to hold various temporary data */
     char peer_id[PEER_ID_SIZE+1], *tmp_str;
+    int invalid, slot;
     Message *msg, *discover_msg;
     Buffer tmp, *table_buf;
     TableIter *it;
@@ -431,30 +1406,36 @@ void execute_command(Command cmd) {
 
     if (cmd.cmd == CMD_CONNECT) { /* If recieved a connect command, take peer id from command peer id and peer address from command content and add it to the peer table, then send a discover message to that peer
  * so that peer will also add "me" to it's peer table */
-        table_buf = serialize_table(conf.peer_table);
-        table_insert(conf.peer_table, buffer_from_str(cmd.peer_id, 0), buffer_from_str(cmd.content, 1));
-
-        discover_msg = new_message(table_buf, "discover", peer_id);
+        memcpy(peer_id, cmd.peer_id, PEER_ID_SIZE);
+        peer_id[PEER_ID_SIZE] = 0;
+        tmp.len = PEER_ID_SIZE;
+        tmp.data = cmd.peer_id;
+        table_buf = serialize_peer_table(directory_write_begin(conf.peer_table)); /* the table before the new peer joins it */
+        invalid = cmd.content_len == 0 || directory_insert(conf.peer_table, tmp, cmd.content, cmd.content_len); /* the address is parsed once, here */
+        directory_write_end(conf.peer_table);
+
+        if (invalid) {
+            tmp_str = "invalid peer address";
+        } else {
+            discover_msg = new_message(table_buf, "discover", peer_id);
+            enqueue_message(outbox, discover_msg);
+            tmp_str = "connect executed";
+        }
         free_buffer(table_buf);
 
-        enqueue_message(&outbox_mutex, outbox, discover_msg);
-        client();
-        tmp_str = "connect executed";
-
     }else if (cmd.cmd == CMD_DISCOVER) {/* If recieved a discover command, broadcast a discover message to all peers in "my" peer table */
         tmp = buffer_from_str("0", 1);
 
-        it = table_iter_new(conf.peer_table);
+        it = table_iter_new(directory_read_begin(conf.peer_table, &slot));
 
         while (table_iter_next(it)) {
             if (strncmp((char*)it->curr->key.data, conf.peer_id, PEER_ID_SIZE) != 0) {
                 discover_msg = new_message(&tmp, conf.peer_id, "discover");
                 memcpy(discover_msg->through_peer, it->curr->key.data, PEER_ID_SIZE);
-                enqueue_message(&outbox_mutex, outbox, discover_msg);
+                enqueue_message(outbox, discover_msg);
             }
         }
-        /* invoke handling outbox */
-        client();
+        directory_read_end(conf.peer_table, slot);
 
         free(tmp.data);
         free(it);
@@ -465,11 +1446,18 @@ void execute_command(Command cmd) {
         tmp.len = cmd.content_len;
         tmp.data = cmd.content;
         msg = new_message(&tmp, conf.peer_id, cmd.peer_id);
-        enqueue_message(&outbox_mutex, outbox, msg);
-        /* invoke handling outbox */
-        client();
+        msg->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+        enqueue_message(outbox, msg); /* a worker handles it */
         tmp_str = "send executed";
 
+    }else if (cmd.cmd == CMD_SUBSCRIBE) {
+        session->subscribed = 1;
+        tmp_str = "subscribe executed";
+
+    }else if (cmd.cmd == CMD_UNSUBSCRIBE) {
+        session->subscribed = 0;
+        tmp_str = "unsubscribe executed";
+
     }else {
         tmp_str = "unrecognized command";
     }
@@ -482,10 +1470,8 @@ void execute_command(Command cmd) {
     resp->content = malloc(resp->content_len);
     memcpy(resp->content, tmp_str, resp->content_len);
 
-    /* Add ClientResponse to personal inbox in order to send it to the interface client */
-    pthread_mutex_lock(&personal_inbox_mutex);
-    list_push(personal_inbox, resp);
-    pthread_mutex_unlock(&personal_inbox_mutex);
+    /* Queue the ClientResponse on the session of the client that sent the command */
+    session_push(session, resp);
 }
 
 size_t find_buf_len(char buff[BUFFER_SIZE]) {
@@ -497,21 +1483,239 @@ size_t find_buf_len(char buff[BUFFER_SIZE]) {
 }
 
 /**
- * Thread function that listens on the configured interface port for commands from a client program which knows the expected data communication format
+ * Executes every command whose bytes are complete in the receive buffer of an interface client, and keeps the bytes of the next incomplete
+ * command at the start of the buffer. Each command is prefixed by a size_t holding its total length, the prefix included
+ *
+ * @param session Pointer to the session of the client
+ * @return Number of commands executed, or -1 if the client sent a length no command can have
+ */
+int consume_commands(Session *session) {
+    Connection *conn;
+    size_t total_len, offset;
+    int count;
+    Command cmd;
+
+    conn = session->conn;
+    count = 0;
+    offset = 0;
+    while (conn->buff.len - offset >= sizeof(size_t)) {
+        memcpy(&total_len, (char *) conn->buff.data + offset, sizeof(size_t));
+        if (total_len < sizeof(size_t) + 1 + PEER_ID_SIZE || total_len > sizeof(size_t) + 1 + PEER_ID_SIZE + conf.max_frame_size) {
+            return -1; /* shorter than a command code and peer id, or longer than anything we would send on */
+        }
+        if (total_len > conn->buff.len - offset) { /* not all of it has arrived yet */
+            break;
+        }
+
+        cmd = deserialize_command((char *) conn->buff.data + offset + sizeof(size_t), total_len - sizeof(size_t));
+        execute_command(cmd, session);
+        if (cmd.content_len > 0) {
+            free(cmd.content);
+        }
+        count++;
+
+        offset += total_len;
+    }
+    if (offset > 0) { /* move the start of the next, still incomplete, command to the front of the buffer */
+        memmove(conn->buff.data, (char *) conn->buff.data + offset, conn->buff.len - offset);
+        conn->buff.len -= offset;
+    }
+
+    return count;
+}
+
+/**
+ * Reads everything currently available from an interface client and executes every command that was completed by those bytes
+ *
+ * @param session Pointer to the session of the client
+ * @return Number of commands executed, or -1 if the client disconnected, failed or sent a malformed command
+ */
+int read_interface(Session *session) {
+    Connection *conn;
+    long read_size;
+    int count, res;
+
+    conn = session->conn;
+    count = 0;
+    while (1) {
+        connection_reserve(conn);
+
+        read_size = recv(conn->fd, (char *) conn->buff.data + conn->buff.len, conn->cap - conn->buff.len, 0);
+        if (read_size == 0) { /* client closed the connection */
+            return -1;
+        }
+        if (read_size < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        conn->buff.len += read_size;
+
+        res = consume_commands(session);
+        if (res < 0) {
+            return -1;
+        }
+        count += res;
+    }
+
+    return count;
+}
+
+/**
+ * Encodes a response the way it is sent to an interface client, prefixed by a size_t holding its total length the same way commands come in,
+ * and frees the response
+ *
+ * @param resp Pointer to the response
+ * @return Buffer holding the bytes to send
+ */
+Buffer encode_response(ClientResponse *resp) {
+    Buffer serialized_resp, encoded;
+    size_t total_len;
+
+    serialized_resp = serialize_response(resp);
+    free(resp->content);
+    free(resp);
+
+    total_len = serialized_resp.len + sizeof(size_t);
+    encoded.len = total_len;
+    encoded.data = malloc(total_len);
+    memcpy(encoded.data, &total_len, sizeof(size_t));
+    memcpy((char *) encoded.data + sizeof(size_t), serialized_resp.data, serialized_resp.len);
+    free(serialized_resp.data);
+
+    return encoded;
+}
+
+/**
+ * Sends as many of the queued responses of a session as the socket of the client takes without blocking
+ *
+ * @param session Pointer to the session
+ * @return 0 if the queue was drained or the socket is full, 1 if the connection to the client failed
+ */
+int session_flush(Session *session) {
+    long res;
+
+    while (1) {
+        if (session->out.data == NULL) {
+            if (session->queue->size == 0) {
+                return 0;
+            }
+            session->out = encode_response((ClientResponse *) list_poplast(session->queue));
+            session->out_sent = 0;
+        }
+
+        res = send(session->conn->fd, (char *) session->out.data + session->out_sent, session->out.len - session->out_sent, MSG_NOSIGNAL);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { /* the rest goes out when epoll reports the socket writable again */
+                return 0;
+            }
+            return 1;
+        }
+        session->out_sent += res;
+        if (session->out_sent == session->out.len) {
+            free(session->out.data);
+            session->out.data = NULL;
+        }
+    }
+}
+
+/**
+ * Creates the session of a newly accepted interface client, the client starts out subscribed
+ *
+ * @param fd Socket of the client
+ * @return Pointer to the new session
+ */
+Session *new_session(int fd) {
+    Session *session;
+
+    session = malloc(sizeof(Session));
+    session->conn = new_connection(fd);
+    session->queue = new_list();
+    session->out.data = NULL;
+    session->out.len = 0;
+    session->out_sent = 0;
+    session->subscribed = 1;
+    session->closed = 0;
+
+    return session;
+}
+
+/**
+ * Closes the connection of an interface session and frees the session along with the responses it didn't send
+ *
+ * @param session Pointer to the session
+ */
+void free_session(Session *session) {
+    ClientResponse *resp;
+
+    while ((resp = (ClientResponse *) list_poplast(session->queue)) != NULL) {
+        free(resp->content);
+        free(resp);
+    }
+    free_list(session->queue);
+    free(session->out.data);
+    close_connection(session->conn);
+    free(session);
+}
+
+/**
+ * Hands every response in the personal inbox to all the subscribed sessions. The responses stay in the personal inbox if no session is subscribed
+ *
+ * @param sessions Array of the sessions
+ * @param n_sessions Number of sessions
+ */
+void deliver_responses(Session **sessions, int n_sessions) {
+    ClientResponse *resp;
+    int i, last;
+
+    last = -1;
+    for (i = 0; i < n_sessions; i++) {
+        if (sessions[i]->subscribed && !sessions[i]->closed) {
+            last = i;
+        }
+    }
+    if (last < 0) {
+        return;
+    }
+
+    while (1) {
+        resp = (ClientResponse *) queue_pop(personal_inbox);
+        if (resp == NULL) {
+            return;
+        }
+
+        for (i = 0; i < last; i++) {
+            if (sessions[i]->subscribed && !sessions[i]->closed) {
+                session_push(sessions[i], copy_response(resp));
+            }
+        }
+        session_push(sessions[last], resp); /* the last subscriber gets the original */
+    }
+}
+
+/**
+ * Thread function that listens on the configured interface port for commands from client programs which know the expected data communication format.
+ * Any number of clients may be connected at once, the thread sleeps until a client sends something, a client socket has room for more
+ * responses or a response is pushed into the personal inbox
  *
  * @param vargp Standard thread program argument pointer
  * @return Never
  */
 void *remote_interface(void *varpg) {
     /* Variables to hold various temporary data */
-    int server_socket, interface_client_socket, break_loop;
+    int server_socket, interface_client_socket, epfd, n_events, i, n_sessions, cap_sessions, inbox_ready;
     struct sockaddr_in server_addr, client_addr;
     socklen_t client_addr_len = sizeof(client_addr);
-    char buff[BUFFER_SIZE], *total_buff;
-    size_t total_buff_len, total_buff_offset, buff_len;
-    Command cmd;
-    ClientResponse *resp;
-    Buffer serialized_resp;
+    struct epoll_event ev, events[MAX_EVENTS];
+    uint64_t counter;
+    Session **sessions, *session;
 
     /* Create socket */
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -524,91 +1728,85 @@ void *remote_interface(void *varpg) {
 
     /* Listen for incoming connections */
     listen(server_socket, 5);
+    set_nonblocking(server_socket);
 
-    while (1) {
-        interface_client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_addr_len); /* accept an incoming connection */
-        break_loop = 0;
-
-        while (!break_loop) { /* Keep looping while the connection is alive */
-            total_buff_len = total_buff_offset = 0;
-            memset(buff, 0, BUFFER_SIZE);
-            buff_len = 0;
-            /* Recieve bytes from the interface client */
-            while ((buff_len = recv(interface_client_socket, buff, BUFFER_SIZE, MSG_DONTWAIT)) > 0) {
-                //buff_len = find_buf_len(buff);
-                if (total_buff_len == 0) { /* first sizeof(size_t) bytes are a size_t number that is the total length of the bytes send from the client*/
-                    memcpy(&total_buff_len, buff, sizeof(size_t)); /* read the total length of bytes */
-                    if (total_buff_len == 0) {
-                        break;
-                    }
-                    total_buff = malloc(total_buff_len); /* allocate space for all the bytes we are about to recieve*/
-                    if (buff_len > sizeof(size_t)) { /* if we received more bytes, put them into the new buffer */
-                        buff_len -= sizeof(size_t); /* if we recieve n bytes, we send n+sizeof(size_t) bytes so the total length of bytes left to recieve is n+sizeof(size_t)-sizeof(size_t)=n*/
-                        memcpy(total_buff, buff + sizeof(size_t), buff_len);
-                        total_buff_offset += buff_len;/* keep track of where in the buffer of total bytes are we recieving to */
-                    }
-                }else {
-                    /* Take in the new bytes into the buffer of all the bytes received */
-                    memcpy(total_buff+total_buff_offset, buff, buff_len);
-                    total_buff_offset += buff_len;
-                }
-                memset(buff, 0, BUFFER_SIZE);
-                buff_len = 0;
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("interface epoll_create1 failed");
+        close(server_socket);
+        return 0;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* the listener is the only registration without a session */
+    epoll_ctl(epfd, EPOLL_CTL_ADD, server_socket, &ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &personal_inbox_event;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, personal_inbox_event, &ev);
 
-                if (total_buff_offset >= total_buff_len - sizeof(size_t)) { /* Once the total amount of bytes recieved equals/exceeds the total we expect to recieve, we deserialize
- * a command struct from those bytes and execute that command freeing space the moment it is no longer needed as we go*/
-                    cmd = deserialize_command(total_buff, total_buff_offset);
-                    free(total_buff);
-                    total_buff_len = total_buff_offset = 0;
+    n_sessions = 0;
+    cap_sessions = 8;
+    sessions = malloc(sizeof(Session *) * cap_sessions);
 
-                    execute_command(cmd);
+    while (1) {
+        n_events = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n_events < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("interface epoll_wait failed");
+            break;
+        }
 
-                    if (cmd.content_len > 0) {
-                        free(cmd.content);
-                        cmd.content_len = 0;
+        inbox_ready = 0;
+        for (i = 0; i < n_events; i++) {
+            if (events[i].data.ptr == NULL) { /* accept every pending client */
+                while ((interface_client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_addr_len)) >= 0) {
+                    set_nonblocking(interface_client_socket);
+                    session = new_session(interface_client_socket);
+                    if (n_sessions == cap_sessions) {
+                        cap_sessions *= 2;
+                        sessions = realloc(sessions, sizeof(Session *) * cap_sessions);
                     }
-
-                    break;/* break out of the recieve loop because we finished recieving the message */
+                    sessions[n_sessions++] = session;
+                    /* edge triggered, reads are drained and writes are retried on every notification */
+                    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+                    ev.data.ptr = session;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, interface_client_socket, &ev);
+                    inbox_ready = 1; /* a new subscriber may take the messages that waited for one */
                 }
-            }
-
-            if (!(errno == EAGAIN || errno == EWOULDBLOCK)) {
-                break_loop = 1;
-            }
 
-            do { /* Read messages from the personal inbox and send them to the interface client */
-                pthread_mutex_lock(&personal_inbox_mutex);
-                resp = (ClientResponse *)list_poplast(personal_inbox);
-                pthread_mutex_unlock(&personal_inbox_mutex);
-
-                if (resp != NULL) {/* If we have messages in the inbox to send to the client, put them into a buffer with a buffer length prefixed and send them off to the client */
-                    serialized_resp = serialize_response(resp);
-                    free(resp->content);
-                    free(resp);
-                    /* In order to send the serialized ClientResponse to the client we use the same technique where we send the bytes + size_t number that contains the length of bytes
-                     * and the client is expected to have and indentical ClientResponse struct to  deserialize into and to know thta the first sizeof(size_t) bytes of the length of the
-                     * total bytes*/
-                    total_buff_len = serialized_resp.len + sizeof(size_t);
-                    total_buff = malloc(total_buff_len);
-                    memcpy(total_buff, &total_buff_len, sizeof(size_t));
-                    memcpy(total_buff + sizeof(size_t), serialized_resp.data, total_buff_len - sizeof(size_t));
-                    free(serialized_resp.data);
-
-                    if (send(interface_client_socket, total_buff, total_buff_len, 0) < 0) {
-                        /* If the message has failed we have lost connection to the client and therefore we break the recieve loop */
-                        printf("interface send failed\n");
-                        free(total_buff);
-                    }
-                    free(total_buff);
-                    total_buff_len = total_buff_offset = 0;
+            } else if (events[i].data.ptr == &personal_inbox_event) { /* reset the notification before draining so a push meanwhile wakes us again */
+                if (read(personal_inbox_event, &counter, sizeof(uint64_t)) < 0 && errno != EAGAIN) {
+                    perror("personal inbox wait failed");
                 }
-            }while(resp != NULL);
+                inbox_ready = 1;
 
-            sleep(1);
+            } else {
+                session = (Session *) events[i].data.ptr;
+                if (!session->closed && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && read_interface(session) < 0) {
+                    session->closed = 1;
+                }
+                inbox_ready = 1; /* a command may have subscribed the session */
+            }
         }
 
-        close(interface_client_socket);
+        if (inbox_ready) {
+            deliver_responses(sessions, n_sessions);
+        }
+        /* send what every session has queued and drop the sessions that are gone */
+        for (i = 0; i < n_sessions; i++) {
+            if (!sessions[i]->closed && session_flush(sessions[i])) {
+                sessions[i]->closed = 1;
+            }
+            if (sessions[i]->closed) {
+                free_session(sessions[i]);
+                sessions[i--] = sessions[--n_sessions];
+            }
+        }
     }
+
+    free(sessions);
+    close(epfd);
     close(server_socket);
 
     return 0;
@@ -616,7 +1814,8 @@ void *remote_interface(void *varpg) {
 
 int main(int argc, char *argv[]) {
     /* Necessary threads */
-    pthread_t server_tid, interface_tid;
+    pthread_t server_tid, interface_tid, worker_tid;
+    int i;
     /*Seed random based on time*/
     srand ( time(NULL) );
 
@@ -627,19 +1826,43 @@ int main(int argc, char *argv[]) {
 
     setlocale(LC_TIME, conf.locale); /* set the locale */
     /* init the global variables */
-    pthread_mutex_init(&outbox_mutex, NULL);
-    pthread_mutex_init(&inbox_mutex, NULL);
-    pthread_mutex_init(&message_table_mutex, NULL);
-    pthread_mutex_init(&personal_inbox_mutex, NULL);
-    outbox = new_list();
-    inbox = new_list();
-    message_table = new_table();
-    personal_inbox = new_list();
+    sem_init(&work_ready, 0, 0);
+    outbox = new_queue(QUEUE_SIZE, &work_ready);
+    inbox = new_queue(QUEUE_SIZE, &work_ready);
+    next_seq = (unsigned long long) now_milliseconds() << MSG_SEQ_TIME_SHIFT;
+    message_table = new_dedup_store(conf.dedup_shards, conf.dedup_window * 1000, conf.dedup_max_origins, conf.dedup_filter_fp_rate, conf.dedup_filter_memory,
+                                    conf.dedup_seq_window);
+    personal_inbox = new_queue(QUEUE_SIZE, NULL); /* the remote interface waits on personal_inbox_event instead */
+    personal_inbox_event = eventfd(0, EFD_NONBLOCK);
+    conn_pool = new_conn_pool(conf.pool_idle_timeout * 1000, conf.connect_timeout, conf.fanout_limit);
+    outbox_batcher = new_batcher(conf.batch_size, conf.batch_linger, conf.peer_queue_limit);
+    udp_sock = udp_open(conf.port); /* datagrams are always received, whether this instance sends them depends on the transport of each peer */
+    if (udp_sock < 0) {
+        printf("failed to open UDP socket, sending over TCP only\n");
+    } else {
+        batcher_enable_udp(outbox_batcher, udp_sock, conf.udp_mtu);
+    }
+    if (conf.io_backend == IO_BACKEND_URING && pool_enable_uring(conn_pool)) {
+        printf("io_uring is not available, using blocking sends\n");
+    }
 
     printf("PEER ID: %s\nIP: %s\nVERSION: 0.0.1\n", conf.peer_id, conf.ip_address);
 
     /* create threads */
-    pthread_create(&server_tid, NULL, net_server, NULL);
+    for (i = 0; i < conf.workers; i++) {
+        pthread_create(&worker_tid, NULL, worker, NULL);
+        pthread_detach(worker_tid);
+    }
+    for (i = 0; i < conf.senders; i++) {
+        pthread_create(&worker_tid, NULL, sender, NULL);
+        pthread_detach(worker_tid);
+    }
+    for (i = conf.listeners - 1; i >= 0; i--) { /* the first listener is created last so server_tid is the one that receives datagrams as well */
+        pthread_create(&server_tid, NULL, net_server, (void *) (long) i);
+        if (i > 0) {
+            pthread_detach(server_tid);
+        }
+    }
     if (conf.interface_port) {
         printf("INTERFACE IP: 127.0.0.1:%d\n", conf.interface_port);
         pthread_create(&interface_tid, NULL, remote_interface, NULL);
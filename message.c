@@ -2,6 +2,7 @@
 // Created by amit on 8/28/23.
 //
 #include "message.h"
+#include "frame.h"
 
 Message *new_message(Buffer* content, char *from, char *to) {
     Message *msg = malloc(sizeof (Message));
@@ -11,7 +12,9 @@ Message *new_message(Buffer* content, char *from, char *to) {
     strncpy(msg->to_peer, to, PEER_ID_SIZE);
     strncpy(msg->from_peer, from, PEER_ID_SIZE);
     memset(msg->through_peer, 0, PEER_ID_SIZE);
+    msg->wire = NULL;
     msg->time = now_milliseconds();
+    msg->seq = 0; /* numbered by the sender if it's a message between peers */
     return msg;
 }
 
@@ -23,54 +26,46 @@ Message *copy_message(Message* msg) {
     strncpy(copy_msg->to_peer, msg->to_peer, PEER_ID_SIZE);
     strncpy(copy_msg->from_peer, msg->from_peer, PEER_ID_SIZE);
     memset(copy_msg->through_peer, 0, PEER_ID_SIZE);
+    copy_msg->time = msg->time;
+    copy_msg->seq = msg->seq;
+    copy_msg->wire = NULL;
     return copy_msg;
 
 }
 
 void free_message(Message *msg) {
-    free(msg->content.data);
+    if (msg->wire != NULL) { /* the content lives in the frame */
+        frame_release(msg->wire);
+    } else {
+        free(msg->content.data);
+    }
     free(msg);
 }
 
-Buffer gen_message_signature(Message *m) {
-    Buffer sgn;
-    sgn.len = PEER_ID_SIZE*2+sizeof (Time);
-    sgn.data = malloc(sgn.len);
-    memcpy(sgn.data, m->from_peer, PEER_ID_SIZE);
-    memcpy(sgn.data + PEER_ID_SIZE, m->to_peer, PEER_ID_SIZE);
-    memcpy(sgn.data + (PEER_ID_SIZE*2), &m->time, sizeof(Time) );
-    return sgn;
-}
-
-Buffer* serialize_msg(Message *m) {
-    Buffer *buff;
-    buff = (Buffer *)malloc(sizeof (Buffer));
-    buff->len = sizeof(Time)+ 2*PEER_ID_SIZE + sizeof (Uint) + m->content.len;/*peer_ids + content_len + content_data*/
-    buff->data = (char*)malloc(buff->len);
-
-    memcpy(buff->data, &m->time, sizeof(Time));
-    memcpy(buff->data+sizeof(Time), m->from_peer, PEER_ID_SIZE);
-    memcpy(buff->data+sizeof(Time)+PEER_ID_SIZE, m->to_peer, PEER_ID_SIZE);
+void serialize_msg_to(Message *m, char *buff) {
+    memcpy(buff, &m->time, sizeof(Time));
+    memcpy(buff+sizeof(Time), m->from_peer, PEER_ID_SIZE);
+    memcpy(buff+sizeof(Time)+PEER_ID_SIZE, m->to_peer, PEER_ID_SIZE);
+    memcpy(buff+sizeof(Time)+2*PEER_ID_SIZE, &m->seq, sizeof(unsigned long long));
 
-    memcpy(buff->data+sizeof(Time)+2*PEER_ID_SIZE, &m->content.len, sizeof(Uint));
-    memcpy(buff->data+sizeof(Time)+2*PEER_ID_SIZE+sizeof(Uint), m->content.data, m->content.len);
-
-    return buff;
+    memcpy(buff+MSG_HEADER_SIZE-sizeof(Uint), &m->content.len, sizeof(Uint));
+    memcpy(buff+MSG_HEADER_SIZE, m->content.data, m->content.len);
 }
 
-Message* deserialize_msg(char* buff) {
-    Message *msg;
-
-    msg = malloc(sizeof (Message));
-
+void deserialize_msg_header(char *buff, Message *msg) {
     memcpy(&msg->time, buff, sizeof (Time));
     memcpy(msg->from_peer, buff+sizeof (Time), PEER_ID_SIZE);
     memcpy(msg->to_peer, buff+sizeof (Time) + PEER_ID_SIZE, PEER_ID_SIZE);
+    memcpy(&msg->seq, buff+sizeof (Time) + 2*PEER_ID_SIZE, sizeof (unsigned long long));
+    memcpy(&msg->content.len, buff + MSG_HEADER_SIZE - sizeof (Uint), sizeof (Uint));
+}
 
-    memcpy(&msg->content.len, buff +sizeof (Time)+ 2*PEER_ID_SIZE, sizeof (Uint));
-    msg->content.data = malloc(msg->content.len);
-    memcpy(msg->content.data, buff +sizeof (Time) + 2*PEER_ID_SIZE + sizeof (Uint), msg->content.len);
-    memset(msg->through_peer, 0, PEER_ID_SIZE);
+Uint serialized_msg_len(char *buff, Uint len) {
+    Uint content_len;
 
-    return msg;
-}
\ No newline at end of file
+    if (len < MSG_HEADER_SIZE) { /* the length of the content is the last field of the header, without it we can't know the total length */
+        return 0;
+    }
+    memcpy(&content_len, buff + MSG_HEADER_SIZE - sizeof (Uint), sizeof (Uint));
+    return MSG_HEADER_SIZE + content_len;
+}
@@ -10,12 +10,17 @@
 #include <string.h>
 #include "util.h"
 
+#define MSG_HEADER_SIZE (sizeof(Time) + 2*PEER_ID_SIZE + sizeof(unsigned long long) + sizeof(Uint)) /* bytes before the content in a serialized message */
+#define MSG_SEQ_TIME_SHIFT 20 /* a peer numbers its messages from the time it started shifted by this many bits, so after a restart it numbers above where it stopped */
+
 typedef struct {
     Time time;
+    unsigned long long seq; /* position of the message among the messages sent by from_peer, 0 if the message isn't numbered */
     char from_peer[PEER_ID_SIZE];
     char to_peer[PEER_ID_SIZE];
     char through_peer[PEER_ID_SIZE];
     Buffer content;
+    struct sharedframe *wire; /* frame the message was received or sent in, the content points into it. NULL until the message is framed */
 
 } Message;
 
@@ -25,10 +30,29 @@ Message *copy_message(Message* msg);
 
 void free_message(Message *msg);
 
-Buffer* serialize_msg(Message *m);
-
-Message* deserialize_msg(char* buff);
-
-Buffer gen_message_signature(Message *m);
+/**
+ * Serializes a message into a buffer that was already allocated
+ *
+ * @param m Pointer to the message
+ * @param buff Buffer with room for at least MSG_HEADER_SIZE + m->content.len bytes
+ */
+void serialize_msg_to(Message *m, char *buff);
+
+/**
+ * Reads the header of a serialized message into a message, the content is left for the caller
+ *
+ * @param buff Buffer holding at least MSG_HEADER_SIZE bytes
+ * @param msg Pointer to the message, its time, seq, peer ids and content length are set
+ */
+void deserialize_msg_header(char *buff, Message *msg);
+
+/**
+ * Calculates the total length of the serialized message at the start of a byte buffer from the content length in its header
+ *
+ * @param buff Bytes received so far
+ * @param len Number of bytes in buff
+ * @return Total length of the first message in buff or 0 if not even the header of the message has been received yet
+ */
+Uint serialized_msg_len(char *buff, Uint len);
 
 #endif //DISTMSG_MESSAGE_H
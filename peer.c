@@ -0,0 +1,188 @@
+/**
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Implementation of peer.h
+ */
+#include <netdb.h>
+
+#include "peer.h"
+
+int peer_parse(PeerAddress *address, char *addr_str, Uint len) {
+    char buff[PEER_ADDR_SIZE], *host, *port, *sep;
+    struct addrinfo hints, *res;
+    int transport, err;
+
+    while (len > 0 && addr_str[len - 1] == 0) { /* addresses from config files and neighbors may or may not include the null terminator */
+        len--;
+    }
+    if (len == 0 || len >= PEER_ADDR_SIZE) {
+        return 1;
+    }
+    memcpy(buff, addr_str, len);
+    buff[len] = 0;
+
+    /* an address may end with /udp or /tcp to choose the transport to that peer */
+    transport = PEER_TRANSPORT_DEFAULT;
+    sep = strrchr(buff, '/');
+    if (sep != NULL) {
+        if (strcmp(sep, "/udp") == 0) {
+            transport = PEER_TRANSPORT_UDP;
+        } else if (strcmp(sep, "/tcp") == 0) {
+            transport = PEER_TRANSPORT_TCP;
+        } else {
+            return 1;
+        }
+        *sep = 0;
+    }
+
+    /* an IPv6 address is written in brackets since it contains colons itself, otherwise the port follows the last colon */
+    if (buff[0] == '[') {
+        host = buff + 1;
+        sep = strchr(host, ']');
+        if (sep == NULL || sep[1] != ':') {
+            return 1;
+        }
+        *sep = 0;
+        port = sep + 2;
+    } else {
+        sep = strrchr(buff, ':');
+        if (sep == NULL) {
+            return 1;
+        }
+        *sep = 0;
+        host = buff;
+        port = sep + 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        printf("failed to resolve peer address %.*s: %s\n", (int) len, addr_str, gai_strerror(err));
+        return 1;
+    }
+    memcpy(&address->addr, res->ai_addr, res->ai_addrlen);
+    address->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    memcpy(address->addr_str, addr_str, len);
+    address->addr_str[len] = 0;
+    address->transport = transport;
+
+    return 0;
+}
+
+Peer *new_peer(char *addr_str, Uint len) {
+    Peer *peer;
+
+    peer = calloc(1, sizeof(Peer));
+    peer->address = malloc(sizeof(PeerAddress));
+    if (peer_parse(peer->address, addr_str, len)) {
+        free(peer->address);
+        free(peer);
+        return NULL;
+    }
+    peer->state = PEER_STATE_UNKNOWN;
+    peer->last_change = now_milliseconds();
+
+    return peer;
+}
+
+int peer_move(Peer *peer, char *addr_str, Uint len, PeerAddress **replaced) {
+    PeerAddress *address;
+    Uint str_len;
+
+    *replaced = NULL;
+    for (str_len = len; str_len > 0 && addr_str[str_len - 1] == 0; str_len--);
+    if (strlen(peer->address->addr_str) == str_len && memcmp(peer->address->addr_str, addr_str, str_len) == 0) { /* neighbors keep telling us about the same peers */
+        return 0;
+    }
+
+    address = malloc(sizeof(PeerAddress));
+    if (peer_parse(address, addr_str, len)) {
+        free(address);
+        return 1;
+    }
+    *replaced = __atomic_exchange_n(&peer->address, address, __ATOMIC_ACQ_REL); /* readers see the old address or the new one, never a mix */
+
+    return 0;
+}
+
+PeerAddress *peer_address(Peer *peer) {
+    return __atomic_load_n(&peer->address, __ATOMIC_ACQUIRE);
+}
+
+Peer *peer_table_search(Table *t, Buffer key) {
+    Buffer *lookup;
+
+    lookup = table_search(t, key);
+    return lookup != NULL ? (Peer *) lookup->data : NULL;
+}
+
+Buffer *serialize_peer_table(Table *t) {
+    TableIter *it;
+    Buffer *buff;
+    PeerAddress **addresses;
+    size_t key_len, val_len;
+    Uint i;
+    char *pos;
+
+    addresses = malloc(sizeof(PeerAddress *) * (t->size + 1));
+    buff = malloc(sizeof(Buffer));
+    buff->len = 0;
+    i = 0;
+    it = table_iter_new(t);
+    while (table_iter_next(it)) { /* size the buffer first so every pair is written straight into it, a peer may move meanwhile so its address is read once */
+        addresses[i] = peer_address((Peer *) it->curr->value.data);
+        buff->len += 2 * sizeof(size_t) + it->curr->key.len + strlen(addresses[i]->addr_str) + 1;
+        i++;
+    }
+    free(it);
+
+    buff->data = malloc(buff->len > 0 ? buff->len : 1);
+    pos = buff->data;
+    i = 0;
+    it = table_iter_new(t);
+    while (table_iter_next(it)) { /* length of the key, the key, length of the value, the value, the same as serialize_table */
+        key_len = it->curr->key.len;
+        val_len = strlen(addresses[i]->addr_str) + 1;
+        memcpy(pos, &key_len, sizeof(size_t));
+        memcpy(pos + sizeof(size_t), it->curr->key.data, key_len);
+        memcpy(pos + sizeof(size_t) + key_len, &val_len, sizeof(size_t));
+        memcpy(pos + 2 * sizeof(size_t) + key_len, addresses[i]->addr_str, val_len);
+        pos += 2 * sizeof(size_t) + key_len + val_len;
+        i++;
+    }
+    free(it);
+    free(addresses);
+
+    return buff;
+}
+
+void peer_record_send(Peer *peer, unsigned long long msgs, unsigned long long bytes, int err) {
+    int state;
+
+    /* several threads may send to the same peer, the counters are only ever added to */
+    if (err) {
+        __atomic_add_fetch(&peer->send_failures, msgs, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&peer->failures, 1, __ATOMIC_RELAXED);
+        state = PEER_STATE_DOWN;
+    } else {
+        __atomic_add_fetch(&peer->msgs_sent, msgs, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&peer->bytes_sent, bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&peer->failures, 0, __ATOMIC_RELAXED);
+        state = PEER_STATE_UP;
+    }
+    if (__atomic_exchange_n(&peer->state, state, __ATOMIC_RELAXED) != state) {
+        peer->last_change = now_milliseconds();
+    }
+}
+
+void peer_record_drop(Peer *peer) {
+    if (__atomic_add_fetch(&peer->queue_drops, 1, __ATOMIC_RELAXED) == 1) { /* only the first one is reported, the counter keeps the rest */
+        printf("dropping messages to %s, too many are waiting to be sent\n", peer_address(peer)->addr_str);
+    }
+}
@@ -0,0 +1,130 @@
+/**
+ * Peer directory entries
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * The values of the peer table are Peer structs holding the address of the peer already resolved into a socket address, so sending a message
+ * never parses address strings. An address is parsed once, when the peer is added from the config file, a connect command or a discovered
+ * peer table. The address string is kept as well since it's what neighbors are told on discovery. Every peer also carries the state of the
+ * connection to it and counters of what was sent to it. A Peer struct lives as long as the program since batches keep pointers to it, while
+ * its address is never changed in place: a peer that moves gets a whole new address which replaces the old one with a single pointer store,
+ * so threads reading the address without a lock see either the old one or the new one
+ */
+
+#ifndef DISTMSG_PEER_H
+#define DISTMSG_PEER_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "util.h"
+#include "table.h"
+
+#define PEER_ADDR_SIZE 128 /* longest address string kept for a peer, "host:port" or "[ipv6]:port" with an optional /udp or /tcp */
+
+/**
+ * Transport chosen for a peer by the suffix of its address
+ */
+#define PEER_TRANSPORT_DEFAULT 0 /* no suffix, the configured transport is used */
+#define PEER_TRANSPORT_TCP 1 /* address ends with /tcp */
+#define PEER_TRANSPORT_UDP 2 /* address ends with /udp */
+
+/**
+ * State of the connection to a peer
+ */
+#define PEER_STATE_UNKNOWN 0 /* nothing was sent to the peer yet */
+#define PEER_STATE_UP 1 /* the last send to the peer succeeded */
+#define PEER_STATE_DOWN 2 /* the last send to the peer failed */
+
+/**
+ * Holds an address of a peer, never changed once the peer points at it
+ */
+typedef struct {
+    char addr_str[PEER_ADDR_SIZE]; /* the address as it was given, null terminated */
+    struct sockaddr_storage addr; /* the resolved address, IPv4 or IPv6 */
+    socklen_t addr_len; /* length of addr in bytes */
+    int transport; /* PEER_TRANSPORT_* */
+} PeerAddress;
+
+/**
+ * Holds everything known about a peer in the peer table
+ */
+typedef struct {
+    PeerAddress *address; /* current address of the peer, read with peer_address */
+    int state; /* PEER_STATE_* */
+    int failures; /* sends that failed in a row */
+    Time last_change; /* time in milliseconds the state last changed */
+    unsigned long long msgs_sent; /* messages sent to the peer */
+    unsigned long long bytes_sent; /* bytes of framed messages sent to the peer */
+    unsigned long long send_failures; /* messages that could not be sent to the peer */
+    unsigned long long queue_drops; /* messages dropped because too many were waiting to be sent to the peer */
+} Peer;
+
+/**
+ * Parses and resolves an address string
+ *
+ * @param address Pointer to the address to fill
+ * @param addr_str The address, "host:port" or "[ipv6]:port" optionally followed by /udp or /tcp, need not be null terminated
+ * @param len Number of bytes in addr_str
+ * @return 1 if the address could not be parsed or resolved, 0 otherwise
+ */
+int peer_parse(PeerAddress *address, char *addr_str, Uint len);
+/**
+ * Creates a new peer at a given address
+ *
+ * @param addr_str The address of the peer, need not be null terminated
+ * @param len Number of bytes in addr_str
+ * @return Pointer to the new peer, or NULL if the address could not be parsed or resolved
+ */
+Peer *new_peer(char *addr_str, Uint len);
+/**
+ * Moves a peer to a given address. Nothing changes if the peer is already there, otherwise the new address replaces the old one, which
+ * threads may still be reading, so it is handed back to the caller to free once they are done with it
+ *
+ * @param peer Pointer to the peer
+ * @param addr_str The new address of the peer, need not be null terminated
+ * @param len Number of bytes in addr_str
+ * @param replaced Pointer to a pointer which is set to the old address, or to NULL if the peer didn't move
+ * @return 1 if the address could not be parsed or resolved, in which case the peer is not changed, 0 otherwise
+ */
+int peer_move(Peer *peer, char *addr_str, Uint len, PeerAddress **replaced);
+/**
+ * Returns the current address of a peer
+ *
+ * @param peer Pointer to the peer
+ * @return Pointer to the address, valid for as long as the reader is inside a read of the peer directory
+ */
+PeerAddress *peer_address(Peer *peer);
+/**
+ * Looks up a peer in a peer table
+ *
+ * @param t Pointer to the peer table
+ * @param key Buffer containing the peer id
+ * @return Pointer to the peer or NULL if it's not in the table
+ */
+Peer *peer_table_search(Table *t, Buffer key);
+/**
+ * Serializes a peer table in the format of serialize_table with the address string of every peer as its value, which is what neighbors
+ * expect on discovery
+ *
+ * @param t Pointer to the peer table
+ * @return Pointer to a new buffer holding the serialized table
+ */
+Buffer *serialize_peer_table(Table *t);
+/**
+ * Records the outcome of sending messages to a peer
+ *
+ * @param peer Pointer to the peer
+ * @param msgs Number of messages sent
+ * @param bytes Number of bytes sent
+ * @param err 1 if the send failed, 0 otherwise
+ */
+void peer_record_send(Peer *peer, unsigned long long msgs, unsigned long long bytes, int err);
+/**
+ * Records a message that was dropped because too many were waiting to be sent to a peer
+ *
+ * @param peer Pointer to the peer
+ */
+void peer_record_drop(Peer *peer);
+
+#endif //DISTMSG_PEER_H
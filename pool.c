@@ -0,0 +1,958 @@
+/**
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Implementation of pool.h
+ */
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "pool.h"
+#include "list.h"
+
+#define FANOUT_CONNECTING 0 /* waiting for a non-blocking connect to complete */
+#define FANOUT_WRITING 1 /* connected, waiting for room in the socket buffer */
+#define FANOUT_DONE 2 /* sent or failed */
+
+/**
+ * Holds the progress of the send to one peer made by pool_sendv_parallel
+ */
+typedef struct {
+    int state; /* FANOUT_* */
+    int fd; /* socket the send is made on, -1 if none */
+    PooledConnection *conn; /* pooled connection the send is made on, NULL while connecting */
+    int reused; /* 1 if the connection was in the pool before this send */
+    long written; /* bytes of the buffers written so far */
+    long total; /* bytes of all the buffers together */
+    Time deadline; /* time in milliseconds by which the send must make progress */
+} FanoutState;
+
+/**
+ * Starts a non-blocking connect to a peer
+ *
+ * @param addr Address of the peer
+ * @param addr_len Length of addr in bytes
+ * @param in_progress Pointer to a flag which is set to 1 if the connect is still in progress, 0 if it completed right away
+ * @return The socket of the connection or -1 if it could not be connected
+ */
+int pool_connect_start(struct sockaddr *addr, socklen_t addr_len, int *in_progress) {
+    int sock, opt;
+
+    /* Create socket */
+    sock = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock == -1) {
+        printf("failed to create socket\n");
+        return -1;
+    }
+    opt = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)); /* messages are written whole, don't let small ones wait for the previous ones to be acknowledged */
+    /* Connect to target */
+    *in_progress = 0;
+    if (connect(sock, addr, addr_len) < 0) {
+        if (errno != EINPROGRESS) {
+            perror("connect failed\n");
+            close(sock);
+            return -1;
+        }
+        *in_progress = 1;
+    }
+
+    return sock;
+}
+
+/**
+ * Checks the outcome of a non-blocking connect once the socket became writable, and puts a connected socket back into blocking mode with
+ * writes that give up after the connect timeout
+ *
+ * @param fd The socket
+ * @param timeout Milliseconds a blocking write may go without progress
+ * @return 1 if the connect failed, 0 otherwise
+ */
+int pool_connect_finish(int fd, Time timeout) {
+    int err, flags;
+    socklen_t len;
+    struct timeval tv;
+
+    err = 0;
+    len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        errno = err;
+        perror("connect failed\n");
+        return 1;
+    }
+    flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)); /* a peer that stopped reading can't hold a blocking send forever */
+
+    return 0;
+}
+
+/**
+ * Opens a new connection to a peer, waiting at most the connect timeout for it
+ *
+ * @param addr Address of the peer
+ * @param addr_len Length of addr in bytes
+ * @param timeout Milliseconds to wait for the connection
+ * @return The socket of the connection or -1 if it could not be connected
+ */
+int pool_connect(struct sockaddr *addr, socklen_t addr_len, Time timeout) {
+    int sock, in_progress, res;
+    struct pollfd pfd;
+
+    sock = pool_connect_start(addr, addr_len, &in_progress);
+    if (sock < 0) {
+        return -1;
+    }
+    if (in_progress) {
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        while ((res = poll(&pfd, 1, (int) timeout)) < 0 && errno == EINTR);
+        if (res == 0) {
+            printf("connect timed out\n");
+        }
+        if (res <= 0) {
+            close(sock);
+            return -1;
+        }
+    }
+    if (pool_connect_finish(sock, timeout)) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/**
+ * Checks if a pooled connection is still usable, a peer that closed its end makes the socket readable with end of file
+ *
+ * @param fd The socket of the connection
+ * @return 1 if the connection can be used, 0 if it was closed by the peer
+ */
+int pool_conn_alive(int fd) {
+    struct pollfd pfd;
+    char c;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) <= 0) { /* nothing to read, the peer never sends on this connection unless it's closing it */
+        return 1;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        return 0;
+    }
+    return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 0;
+}
+
+/**
+ * Points an iovec array at the part of several buffers which is still to be written
+ *
+ * @param iov Array of at least POOL_MAX_IOV iovecs
+ * @param buffs Array of pointers to the buffers
+ * @param count Number of buffers in buffs
+ * @param written Number of bytes from the start of the buffers which were already written and should be skipped
+ * @return Number of iovecs filled, 0 if everything was written
+ */
+int pool_fill_iov(struct iovec *iov, Buffer **buffs, int count, long written) {
+    int first, n, i;
+
+    first = 0;
+    while (first < count && written >= (long) buffs[first]->len) { /* skip the buffers that were written completely */
+        written -= buffs[first]->len;
+        first++;
+    }
+    n = count - first < POOL_MAX_IOV ? count - first : POOL_MAX_IOV;
+    for (i = 0; i < n; i++) { /* the first buffer may have been written partially */
+        iov[i].iov_base = (char *) buffs[first + i]->data + (i == 0 ? written : 0);
+        iov[i].iov_len = buffs[first + i]->len - (i == 0 ? written : 0);
+    }
+    return n;
+}
+
+/**
+ * Writes as much of several buffers to a socket as one vectored write takes
+ *
+ * @param fd The socket
+ * @param buffs Array of pointers to the buffers to write
+ * @param count Number of buffers in buffs
+ * @param written Number of bytes from the start of the buffers which were already written and should be skipped
+ * @param flags Flags for sendmsg besides MSG_NOSIGNAL
+ * @return Number of bytes written, 0 if the write would block or was interrupted, -1 if there was an error
+ */
+long pool_write_some(int fd, Buffer **buffs, int count, long written, int flags) {
+    struct iovec iov[POOL_MAX_IOV];
+    struct msghdr hdr;
+    long sent;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = pool_fill_iov(iov, buffs, count, written);
+    if (hdr.msg_iovlen == 0) {
+        return 0;
+    }
+
+    sent = sendmsg(fd, &hdr, MSG_NOSIGNAL | flags); /* sendmsg is writev with flags, a dropped connection must not kill the program with SIGPIPE */
+    if (sent < 0) {
+        if (errno == EINTR || ((flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+            return 0;
+        }
+        return -1; /* on a blocking socket EAGAIN means the write timed out */
+    }
+    return sent;
+}
+
+/**
+ * Writes all the bytes of several buffers to a socket using as few writev calls as possible
+ *
+ * @param fd The socket
+ * @param buffs Array of pointers to the buffers to write
+ * @param count Number of buffers in buffs
+ * @param written Pointer to the number of bytes from the start of the buffers which were already written and should be skipped, advanced
+ * by every byte written
+ * @return 1 if there was an error, 0 otherwise
+ */
+int pool_write_all(int fd, Buffer **buffs, int count, long *written) {
+    long total, sent;
+    int i;
+
+    total = 0;
+    for (i = 0; i < count; i++) {
+        total += buffs[i]->len;
+    }
+    while (*written < total) {
+        sent = pool_write_some(fd, buffs, count, *written, 0);
+        if (sent < 0) {
+            return 1;
+        }
+        *written += sent;
+    }
+    return 0;
+}
+
+ConnPool *new_conn_pool(Time idle_timeout, Time connect_timeout, int max_inflight) {
+    ConnPool *pool;
+
+    pool = malloc(sizeof(ConnPool));
+    pool->conns = new_table();
+    pool->idle_timeout = idle_timeout;
+    pool->connect_timeout = connect_timeout;
+    pool->max_inflight = max_inflight > 0 ? max_inflight : 1;
+    pool->next_id = 1; /* 0 stands for no connection */
+    pool->last_sweep = now_milliseconds();
+#ifdef HAVE_IO_URING
+    pool->ring = NULL;
+    pthread_mutex_init(&pool->ring_mutex, NULL);
+    pool->ring_broken = 0;
+#endif
+    pthread_mutex_init(&pool->mutex, NULL);
+
+    return pool;
+}
+
+void free_conn_pool(ConnPool *pool) {
+    TableIter *it;
+    PooledConnection *conn;
+
+    it = table_iter_new(pool->conns);
+    while (table_iter_next(it)) { /* close every connection, the table only frees its keys */
+        conn = (PooledConnection *) it->curr->value.data;
+        close(conn->fd);
+        free(conn);
+    }
+    free(it);
+    free_table(pool->conns);
+#ifdef HAVE_IO_URING
+    if (pool->ring != NULL) {
+        uring_exit(pool->ring);
+        free(pool->ring);
+    }
+    pthread_mutex_destroy(&pool->ring_mutex);
+#endif
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+/**
+ * Removes the connection to a peer from the pool, the pool mutex must be held
+ *
+ * @param pool Pointer to the pool
+ * @param key Buffer containing the peer id
+ */
+void pool_remove(ConnPool *pool, Buffer key) {
+    Buffer *value;
+    PooledConnection *conn;
+
+    value = table_search(pool->conns, key);
+    if (value != NULL) {
+        conn = (PooledConnection *) value->data;
+        close(conn->fd);
+        free(conn);
+        table_delete(pool->conns, key);
+    }
+}
+
+int pool_send(ConnPool *pool, char *peer_id, struct sockaddr *addr, socklen_t addr_len, Buffer *buff) {
+    return pool_sendv(pool, peer_id, addr, addr_len, &buff, 1);
+}
+
+/**
+ * Adds a connected socket to the pool as the connection to a peer, the pool mutex must be held
+ *
+ * @param pool Pointer to the pool
+ * @param key Buffer containing the peer id
+ * @param fd The socket
+ * @return Pointer to the new pooled connection
+ */
+PooledConnection *pool_add(ConnPool *pool, Buffer key, int fd) {
+    PooledConnection *conn;
+    Buffer value;
+
+    conn = malloc(sizeof(PooledConnection));
+    conn->fd = fd;
+    conn->last_used = now_milliseconds();
+    conn->busy = 0;
+    conn->id = pool->next_id++;
+    value.len = sizeof(PooledConnection);
+    value.data = conn;
+    table_insert(pool->conns, key, value);
+
+    return conn;
+}
+
+/**
+ * Returns the pooled connection to a peer if there is one and the peer didn't drop it since it was last used. The pool mutex must be held
+ *
+ * @param pool Pointer to the pool
+ * @param key Buffer containing the peer id
+ * @return Pointer to the pooled connection or NULL if there is no usable one
+ */
+PooledConnection *pool_lookup(ConnPool *pool, Buffer key) {
+    Buffer *lookup;
+    PooledConnection *conn;
+
+    lookup = table_search(pool->conns, key);
+    conn = lookup != NULL ? (PooledConnection *) lookup->data : NULL;
+
+    if (conn != NULL && !pool_conn_alive(conn->fd)) { /* the peer dropped the connection since we last used it */
+        pool_remove(pool, key);
+        conn = NULL;
+    }
+    return conn;
+}
+
+/**
+ * Records the outcome of a send on a pooled connection, a connection which failed is dropped from the pool. The pool mutex must be held
+ *
+ * @param pool Pointer to the pool
+ * @param key Buffer containing the peer id
+ * @param conn Pointer to the connection the send was made on
+ * @param err 1 if the send failed, 0 otherwise
+ */
+void pool_finish(ConnPool *pool, Buffer key, PooledConnection *conn, int err) {
+    if (err) {
+        printf("send failed\n");
+        pool_remove(pool, key);
+    } else {
+        conn->last_used = now_milliseconds();
+    }
+}
+
+/**
+ * Checks for idle connections every so often, not on every send
+ *
+ * @param pool Pointer to the pool
+ */
+void pool_maybe_sweep(ConnPool *pool) {
+    if (now_milliseconds() - pool->last_sweep > pool->idle_timeout / 2) {
+        pool_evict_idle(pool);
+    }
+}
+
+/**
+ * Looks up the pooled connection to a peer like pool_lookup and marks it busy, so it can be written to without holding the pool mutex
+ *
+ * @param pool Pointer to the pool
+ * @param key Buffer containing the peer id
+ * @param pin Id of the connection wanted, 0 for whichever connection the peer has
+ * @return Pointer to the pooled connection or NULL if there is no usable one
+ */
+PooledConnection *pool_claim(ConnPool *pool, Buffer key, unsigned long long pin) {
+    PooledConnection *conn;
+
+    pthread_mutex_lock(&pool->mutex);
+    conn = pool_lookup(pool, key);
+    if (conn != NULL && pin != 0 && conn->id != pin) { /* the connection wanted was replaced */
+        conn = NULL;
+    }
+    if (conn != NULL) {
+        conn->busy = 1;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return conn;
+}
+
+/**
+ * Adds a socket connected without holding the pool mutex to the pool, marked busy
+ *
+ * @param pool Pointer to the pool
+ * @param key Buffer containing the peer id
+ * @param fd The socket
+ * @return Pointer to the new pooled connection
+ */
+PooledConnection *pool_add_busy(ConnPool *pool, Buffer key, int fd) {
+    PooledConnection *conn;
+
+    pthread_mutex_lock(&pool->mutex);
+    conn = pool_add(pool, key, fd);
+    conn->busy = 1;
+    pthread_mutex_unlock(&pool->mutex);
+    return conn;
+}
+
+/**
+ * Records the outcome of a send made on a busy connection like pool_finish and lets idle sweeps see the connection again
+ *
+ * @param pool Pointer to the pool
+ * @param key Buffer containing the peer id
+ * @param conn Pointer to the connection the send was made on
+ * @param err 1 if the send failed, 0 otherwise
+ */
+void pool_release(ConnPool *pool, Buffer key, PooledConnection *conn, int err) {
+    pthread_mutex_lock(&pool->mutex);
+    conn->busy = 0;
+    pool_finish(pool, key, conn, err);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * Drops the connection to a peer from the pool, for a connection which broke while it was busy
+ *
+ * @param pool Pointer to the pool
+ * @param key Buffer containing the peer id
+ */
+void pool_drop(ConnPool *pool, Buffer key) {
+    pthread_mutex_lock(&pool->mutex);
+    pool_remove(pool, key);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * Connects to a peer without holding the pool mutex and adds the connection to the pool marked busy
+ *
+ * @param pool Pointer to the pool
+ * @param key Buffer containing the peer id
+ * @param addr Address of the peer
+ * @param addr_len Length of addr in bytes
+ * @return Pointer to the new pooled connection or NULL if the peer could not be connected
+ */
+PooledConnection *pool_open_unlocked(ConnPool *pool, Buffer key, struct sockaddr *addr, socklen_t addr_len) {
+    int fd;
+
+    fd = pool_connect(addr, addr_len, pool->connect_timeout);
+    if (fd < 0) {
+        return NULL;
+    }
+    return pool_add_busy(pool, key, fd);
+}
+
+/**
+ * Makes a single send, see pool_sendv
+ *
+ * @param pool Pointer to the pool
+ * @param send Pointer to the send, its err, written and conn_id fields are set
+ */
+void pool_send_one(ConnPool *pool, PoolSend *send) {
+    Buffer key;
+    PooledConnection *conn;
+    int reused;
+
+    key.len = PEER_ID_SIZE;
+    key.data = send->peer_id;
+    send->err = 1;
+    send->written = 0;
+    send->conn_id = 0;
+
+    conn = pool_claim(pool, key, send->pin);
+    reused = conn != NULL;
+
+    if (conn == NULL && send->pin == 0) { /* connecting may take up to the connect timeout, other peers are sent to meanwhile */
+        conn = pool_open_unlocked(pool, key, send->addr, send->addr_len);
+    }
+    if (conn == NULL) {
+        return;
+    }
+
+    send->err = pool_write_all(conn->fd, send->buffs, send->count, &send->written);
+    if (send->err && reused && send->written == 0 && send->pin == 0) { /* the connection may have broken since it was checked, try once more on a fresh one */
+        pool_drop(pool, key);
+        conn = pool_open_unlocked(pool, key, send->addr, send->addr_len);
+        send->err = conn == NULL || pool_write_all(conn->fd, send->buffs, send->count, &send->written);
+    }
+    if (conn != NULL) {
+        send->conn_id = send->err ? 0 : conn->id;
+        pool_release(pool, key, conn, send->err);
+    }
+}
+
+int pool_sendv(ConnPool *pool, char *peer_id, struct sockaddr *addr, socklen_t addr_len, Buffer **buffs, int count) {
+    PoolSend send;
+
+    send.peer_id = peer_id;
+    send.addr = addr;
+    send.addr_len = addr_len;
+    send.buffs = buffs;
+    send.count = count;
+    send.pin = 0;
+    pool_send_one(pool, &send);
+
+    pool_maybe_sweep(pool);
+
+    return send.err;
+}
+
+/**
+ * Finishes the send to one peer of a parallel send
+ *
+ * @param pool Pointer to the pool
+ * @param send Pointer to the send
+ * @param st Pointer to the progress of the send
+ * @param err 1 if the send failed, 0 otherwise
+ */
+void pool_fanout_end(ConnPool *pool, PoolSend *send, FanoutState *st, int err) {
+    Buffer key;
+
+    key.len = PEER_ID_SIZE;
+    key.data = send->peer_id;
+    send->err = err;
+    send->written = st->written;
+    send->conn_id = st->conn != NULL && !err ? st->conn->id : 0;
+    st->state = FANOUT_DONE;
+    if (st->conn != NULL) {
+        pool_release(pool, key, st->conn, err);
+    } else if (st->fd >= 0) { /* never made it into the pool */
+        close(st->fd);
+    }
+}
+
+/**
+ * Starts a non-blocking connect for the send to one peer of a parallel send
+ *
+ * @param pool Pointer to the pool
+ * @param send Pointer to the send
+ * @param st Pointer to the progress of the send
+ */
+void pool_fanout_connect(ConnPool *pool, PoolSend *send, FanoutState *st) {
+    int in_progress;
+
+    st->conn = NULL;
+    st->reused = 0;
+    st->written = 0;
+    st->fd = pool_connect_start(send->addr, send->addr_len, &in_progress);
+    st->deadline = now_milliseconds() + pool->connect_timeout;
+    if (st->fd < 0) {
+        pool_fanout_end(pool, send, st, 1);
+    } else {
+        st->state = FANOUT_CONNECTING; /* even a connect that completed right away is finished once poll reports the socket writable */
+    }
+}
+
+/**
+ * Moves the send to one peer of a parallel send on once its connect completed, a connected socket joins the pool
+ *
+ * @param pool Pointer to the pool
+ * @param send Pointer to the send
+ * @param st Pointer to the progress of the send
+ */
+void pool_fanout_connected(ConnPool *pool, PoolSend *send, FanoutState *st) {
+    Buffer key;
+
+    if (pool_connect_finish(st->fd, pool->connect_timeout)) {
+        pool_fanout_end(pool, send, st, 1);
+        return;
+    }
+    key.len = PEER_ID_SIZE;
+    key.data = send->peer_id;
+    st->conn = pool_add_busy(pool, key, st->fd);
+    st->state = FANOUT_WRITING;
+    st->deadline = now_milliseconds() + pool->connect_timeout;
+}
+
+/**
+ * Writes as much of the send to one peer of a parallel send as the socket takes without blocking
+ *
+ * @param pool Pointer to the pool
+ * @param send Pointer to the send
+ * @param st Pointer to the progress of the send
+ */
+void pool_fanout_write(ConnPool *pool, PoolSend *send, FanoutState *st) {
+    Buffer key;
+    long sent;
+
+    sent = pool_write_some(st->fd, send->buffs, send->count, st->written, MSG_DONTWAIT);
+    if (sent < 0) {
+        if (st->reused && st->written == 0 && send->pin == 0) { /* the connection may have broken since it was checked, try once more on a fresh one */
+            key.len = PEER_ID_SIZE;
+            key.data = send->peer_id;
+            pool_drop(pool, key);
+            pool_fanout_connect(pool, send, st);
+        } else {
+            pool_fanout_end(pool, send, st, 1);
+        }
+        return;
+    }
+    if (sent > 0) {
+        st->written += sent;
+        st->deadline = now_milliseconds() + pool->connect_timeout;
+    }
+    if (st->written == st->total) {
+        pool_fanout_end(pool, send, st, 0);
+    }
+}
+
+/**
+ * Sends to several peers side by side. Connects and writes are non-blocking and all the peers that are waited on are polled together, at most
+ * max_inflight peers at a time, and a peer that makes no progress for the connect timeout fails without holding up the others. The
+ * connections are marked busy while they are written to, the pool mutex is only held to look them up and to record the outcomes
+ *
+ * @param pool Pointer to the pool
+ * @param sends Array of the sends, each to a different peer
+ * @param n Number of sends
+ */
+void pool_sendv_parallel(ConnPool *pool, PoolSend *sends, int n) {
+    FanoutState *st;
+    struct pollfd *pfds;
+    int *slots, i, j, next, active, n_poll, res;
+    Time now, first_deadline;
+    Buffer key;
+
+    st = calloc(n, sizeof(FanoutState));
+    pfds = malloc(sizeof(struct pollfd) * n);
+    slots = malloc(sizeof(int) * n);
+    key.len = PEER_ID_SIZE;
+    next = active = 0;
+
+    while (next < n || active > 0) {
+        while (next < n && active < pool->max_inflight) { /* start more sends while there is room */
+            for (j = 0; j < sends[next].count; j++) {
+                st[next].total += sends[next].buffs[j]->len;
+            }
+            key.data = sends[next].peer_id;
+            st[next].fd = -1;
+            st[next].conn = pool_claim(pool, key, sends[next].pin);
+            if (st[next].conn != NULL) {
+                st[next].fd = st[next].conn->fd;
+                st[next].reused = 1;
+                st[next].state = FANOUT_WRITING;
+                st[next].deadline = now_milliseconds() + pool->connect_timeout;
+            } else if (sends[next].pin != 0) { /* the connection the send is pinned to is gone */
+                pool_fanout_end(pool, &sends[next], &st[next], 1);
+            } else {
+                pool_fanout_connect(pool, &sends[next], &st[next]);
+            }
+            active += st[next].state != FANOUT_DONE;
+            next++;
+        }
+
+        /* write to every connected peer, then wait on the peers that are still connecting or whose socket buffer is full */
+        n_poll = 0;
+        first_deadline = -1;
+        for (i = 0; i < next; i++) {
+            if (st[i].state == FANOUT_WRITING) {
+                pool_fanout_write(pool, &sends[i], &st[i]);
+            }
+            if (st[i].state == FANOUT_DONE) {
+                continue;
+            }
+            now = now_milliseconds();
+            if (now >= st[i].deadline) {
+                printf("send to %.*s timed out\n", PEER_ID_SIZE, sends[i].peer_id);
+                pool_fanout_end(pool, &sends[i], &st[i], 1);
+                continue;
+            }
+            pfds[n_poll].fd = st[i].fd;
+            pfds[n_poll].events = POLLOUT;
+            pfds[n_poll].revents = 0;
+            slots[n_poll++] = i;
+            if (first_deadline < 0 || st[i].deadline < first_deadline) {
+                first_deadline = st[i].deadline;
+            }
+        }
+        active = n_poll;
+        if (n_poll == 0) {
+            continue;
+        }
+
+        res = poll(pfds, n_poll, (int) (first_deadline - now_milliseconds() > 0 ? first_deadline - now_milliseconds() : 0));
+        if (res < 0 && errno != EINTR) {
+            perror("poll failed");
+            for (j = 0; j < n_poll; j++) {
+                pool_fanout_end(pool, &sends[slots[j]], &st[slots[j]], 1);
+            }
+            active = 0;
+            continue;
+        }
+        for (j = 0; res > 0 && j < n_poll; j++) {
+            i = slots[j];
+            if (pfds[j].revents && st[i].state == FANOUT_CONNECTING) {
+                pool_fanout_connected(pool, &sends[i], &st[i]);
+                active -= st[i].state == FANOUT_DONE;
+            } /* writable connections are written to at the top of the loop */
+        }
+    }
+
+    free(st);
+    free(pfds);
+    free(slots);
+}
+
+#ifdef HAVE_IO_URING
+/**
+ * Sends to several peers at once by submitting a sendmsg for every peer to the io_uring of the pool and reaping all the completions together.
+ * Whatever a sendmsg didn't manage to write, or a send that failed on a reused connection, is finished with the blocking path. The
+ * connections are marked busy until their completion is reaped, the pool mutex is only held to look them up and to record the outcomes.
+ * The ring mutex is held from the first submission until the last completion of this call is reaped, so no other sender thread submits
+ * in between or reaps a completion of this call, and is released before the blocking path runs
+ *
+ * @param pool Pointer to the pool, its ring must be set
+ * @param sends Array of the sends, each to a different peer
+ * @param n Number of sends
+ */
+void pool_sendv_uring(ConnPool *pool, PoolSend *sends, int n) {
+    struct msghdr *hdrs;
+    struct iovec *iovs;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    PooledConnection **conns;
+    int *reused, *results, *pending, i, j, k, submitted, reaped, res;
+    Buffer key;
+
+    hdrs = calloc(n, sizeof(struct msghdr));
+    iovs = malloc(sizeof(struct iovec) * n * POOL_MAX_IOV);
+    conns = malloc(sizeof(PooledConnection *) * n);
+    reused = malloc(sizeof(int) * n);
+    results = calloc(n, sizeof(int)); /* a send the ring never took wrote 0 bytes, the blocking path writes all of it */
+    pending = calloc(n, sizeof(int));
+    key.len = PEER_ID_SIZE;
+
+    for (i = 0; i < n; i++) {
+        key.data = sends[i].peer_id;
+        conns[i] = pool_claim(pool, key, sends[i].pin);
+        reused[i] = conns[i] != NULL;
+        if (conns[i] == NULL && sends[i].pin == 0) { /* dropped since pool_sendv_split checked, connecting may take up to the connect timeout */
+            conns[i] = pool_open_unlocked(pool, key, sends[i].addr, sends[i].addr_len);
+        }
+        sends[i].err = conns[i] == NULL;
+        sends[i].written = 0;
+        sends[i].conn_id = 0;
+        if (conns[i] == NULL) {
+            continue;
+        }
+        k = sends[i].count < POOL_MAX_IOV ? sends[i].count : POOL_MAX_IOV; /* anything beyond is written by the blocking path after the completion */
+        for (j = 0; j < k; j++) {
+            iovs[i * POOL_MAX_IOV + j].iov_base = sends[i].buffs[j]->data;
+            iovs[i * POOL_MAX_IOV + j].iov_len = sends[i].buffs[j]->len;
+        }
+        hdrs[i].msg_iov = &iovs[i * POOL_MAX_IOV];
+        hdrs[i].msg_iovlen = k;
+    }
+
+    pthread_mutex_lock(&pool->ring_mutex);
+    submitted = reaped = 0;
+    for (i = 0; i < n && !pool->ring_broken; i++) {
+        if (conns[i] == NULL) {
+            continue;
+        }
+        sqe = uring_get_sqe(pool->ring);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conns[i]->fd;
+        sqe->addr = (unsigned long) &hdrs[i];
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = i;
+        pending[i] = 1;
+        submitted++;
+    }
+    while (reaped < submitted) {
+        if (uring_submit_and_wait(pool->ring, 1, -1) < 0) { /* later completions can't be told apart from those of other calls, the ring isn't used again */
+            printf("io_uring of the connection pool failed, sending without it\n");
+            pool->ring_broken = 1;
+            break;
+        }
+        while ((cqe = uring_peek_cqe(pool->ring)) != NULL) {
+            i = (int) cqe->user_data;
+            results[i] = cqe->res;
+            pending[i] = 0;
+            uring_cqe_seen(pool->ring);
+            reaped++;
+        }
+    }
+    pthread_mutex_unlock(&pool->ring_mutex);
+
+    for (i = 0; i < n; i++) {
+        if (conns[i] == NULL) {
+            continue;
+        }
+        key.data = sends[i].peer_id;
+        res = results[i];
+        if (pending[i]) { /* never reaped, there is no telling how much was written */
+            sends[i].err = 1;
+        } else if (res < 0) { /* nothing was written */
+            sends[i].err = 1;
+            if (reused[i] && sends[i].pin == 0) { /* the connection may have broken since it was checked, try once more on a fresh one */
+                pool_drop(pool, key);
+                conns[i] = pool_open_unlocked(pool, key, sends[i].addr, sends[i].addr_len);
+                sends[i].err = conns[i] == NULL || pool_write_all(conns[i]->fd, sends[i].buffs, sends[i].count, &sends[i].written);
+            }
+        } else {
+            sends[i].written = res;
+            sends[i].err = pool_write_all(conns[i]->fd, sends[i].buffs, sends[i].count, &sends[i].written); /* writes nothing if the sendmsg wrote everything */
+        }
+        if (conns[i] != NULL) {
+            sends[i].conn_id = sends[i].err ? 0 : conns[i]->id;
+            pool_release(pool, key, conns[i], sends[i].err);
+        }
+    }
+
+    if (reaped == submitted) { /* otherwise the kernel may still be using the arrays of the sends it didn't complete, so they are not freed */
+        free(hdrs);
+        free(iovs);
+    }
+    free(conns);
+    free(reused);
+    free(results);
+    free(pending);
+}
+
+/**
+ * Sends to several peers through the io_uring of the pool. The ring only writes, so the peers without a pooled connection are first
+ * connected and sent to side by side by pool_sendv_parallel, and the rest is submitted through the ring
+ *
+ * @param pool Pointer to the pool, its ring must be set
+ * @param sends Array of the sends, each to a different peer
+ * @param n Number of sends
+ */
+void pool_sendv_split(ConnPool *pool, PoolSend *sends, int n) {
+    PoolSend *split;
+    int *from, i, n_pooled, n_fresh;
+    Buffer key;
+
+    split = malloc(sizeof(PoolSend) * n);
+    from = malloc(sizeof(int) * n);
+    key.len = PEER_ID_SIZE;
+    n_pooled = 0;
+    n_fresh = n;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (i = 0; i < n; i++) { /* pooled sends fill the array from the start, the others from the end */
+        key.data = sends[i].peer_id;
+        if (pool_lookup(pool, key) != NULL) {
+            from[n_pooled] = i;
+            split[n_pooled++] = sends[i];
+        } else {
+            from[--n_fresh] = i;
+            split[n_fresh] = sends[i];
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (n_fresh < n) {
+        pool_sendv_parallel(pool, split + n_fresh, n - n_fresh);
+    }
+    if (n_pooled > 1) {
+        pool_sendv_uring(pool, split, n_pooled);
+    } else if (n_pooled == 1) {
+        pool_send_one(pool, &split[0]);
+    }
+    for (i = 0; i < n; i++) {
+        sends[from[i]] = split[i];
+    }
+
+    free(split);
+    free(from);
+}
+#endif
+
+void pool_sendv_all(ConnPool *pool, PoolSend *sends, int n) {
+#ifdef HAVE_IO_URING
+    if (pool->ring != NULL && n > 1) { /* a single send costs one system call either way */
+        pool_sendv_split(pool, sends, n);
+        pool_maybe_sweep(pool);
+        return;
+    }
+#endif
+    if (n == 1) {
+        pool_send_one(pool, &sends[0]);
+        pool_maybe_sweep(pool);
+    } else if (n > 1) {
+        pool_sendv_parallel(pool, sends, n);
+        pool_maybe_sweep(pool);
+    }
+}
+
+int pool_enable_uring(ConnPool *pool) {
+#ifdef HAVE_IO_URING
+    Uring *ring;
+
+    ring = malloc(sizeof(Uring));
+    if (uring_init(ring, URING_ENTRIES)) {
+        free(ring);
+        return 1;
+    }
+    pool->ring = ring;
+    return 0;
+#else
+    (void) pool;
+    return 1;
+#endif
+}
+
+void pool_close(ConnPool *pool, char *peer_id) {
+    Buffer key;
+
+    key.len = PEER_ID_SIZE;
+    key.data = peer_id;
+
+    pool_drop(pool, key);
+}
+
+void pool_evict_idle(ConnPool *pool) {
+    TableIter *it;
+    PooledConnection *conn;
+    List *idle;
+    Buffer *key;
+    Time now;
+
+    now = now_milliseconds();
+    idle = new_list();
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->last_sweep = now;
+    it = table_iter_new(pool->conns);
+    while (table_iter_next(it)) { /* collect the keys first since deleting from the table while iterating it would break the iterator */
+        conn = (PooledConnection *) it->curr->value.data;
+        if (!conn->busy && now - conn->last_used > pool->idle_timeout) {
+            key = malloc(sizeof(Buffer)); /* deleting moves pairs around the table, so the keys are copied rather than pointed at */
+            *key = buffer_from_str((char *) it->curr->key.data, it->curr->key.len);
+            list_push(idle, key);
+        }
+    }
+    free(it);
+
+    while ((key = (Buffer *) list_pop(idle)) != NULL) {
+        pool_remove(pool, *key);
+        free_buffer(key);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    free_list(idle);
+}
@@ -0,0 +1,138 @@
+/**
+ * Outbound connection pool
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Keeps one open connection per neighbor peer so that sending a message doesn't cost a TCP handshake, connections are opened lazily on first use,
+ * re-opened when the neighbor drops them and closed after they have been idle for a while. Connecting to or writing to a peer that doesn't make
+ * progress for connect_timeout milliseconds fails the send to that peer, and sends to several peers run side by side so one unreachable peer
+ * doesn't hold up the rest
+ */
+
+#ifndef DISTMSG_POOL_H
+#define DISTMSG_POOL_H
+
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "util.h"
+#include "table.h"
+#include "uring.h"
+
+#define POOL_MAX_IOV 64 /* most buffers handed to a single writev call */
+
+/**
+ * Holds an open connection to a single peer
+ */
+typedef struct {
+    int fd; /* socket of the connection */
+    Time last_used; /* time in milliseconds of the last send on the connection */
+    int busy; /* set while a send writes to the connection without the pool mutex, idle sweeps leave it alone */
+    unsigned long long id; /* number of the connection, never reused within the pool, so a send can tell a re-opened connection apart */
+} PooledConnection;
+/**
+ * Holds all the open connections keyed by peer id
+ */
+typedef struct {
+    Table *conns; /* peer id -> PooledConnection */
+    Time idle_timeout; /* connections unused for this many milliseconds are closed */
+    Time last_sweep; /* time in milliseconds of the last check for idle connections */
+    Time connect_timeout; /* milliseconds a connect or a write to a peer may go without progress before the send to it fails */
+    int max_inflight; /* most peers sent to at the same time by pool_sendv_all */
+    unsigned long long next_id; /* id of the next connection opened */
+#ifdef HAVE_IO_URING
+    Uring *ring; /* when set, sends to several peers are submitted together through this ring */
+    pthread_mutex_t ring_mutex; /* held by a send from its first submission until its last completion is reaped, the sender threads share the ring */
+    int ring_broken; /* set once submitting to the ring failed, its completions can no longer be matched to their sends. Guarded by ring_mutex */
+#endif
+    pthread_mutex_t mutex;
+} ConnPool;
+/**
+ * Holds one of the sends made by pool_sendv_all
+ */
+typedef struct {
+    char *peer_id; /* id of the peer to send to, PEER_ID_SIZE bytes */
+    struct sockaddr *addr; /* address of the peer */
+    socklen_t addr_len; /* length of addr in bytes */
+    Buffer **buffs; /* array of pointers to the buffers to send, in order */
+    int count; /* number of buffers in buffs */
+    unsigned long long pin; /* id of the connection the send must go over, 0 if any will do. A pinned send fails without writing anything if that connection is gone */
+    int err; /* set to 1 if the send failed, 0 otherwise */
+    long written; /* set to the number of bytes written, less than all of them only if the send failed */
+    unsigned long long conn_id; /* set to the id of the connection the send went over, 0 if it failed */
+} PoolSend;
+
+/**
+ * Creates a new empty connection pool
+ *
+ * @param idle_timeout Number of milliseconds after which an unused connection is closed
+ * @param connect_timeout Number of milliseconds a connect or a write to a peer may go without progress before the send to it fails
+ * @param max_inflight Most peers sent to at the same time by pool_sendv_all
+ * @return Pointer to the new pool
+ */
+ConnPool *new_conn_pool(Time idle_timeout, Time connect_timeout, int max_inflight);
+/**
+ * Closes all connections in the pool and frees it
+ *
+ * @param pool Pointer to the pool
+ */
+void free_conn_pool(ConnPool *pool);
+/**
+ * Sends a buffer of bytes to a peer over the pooled connection to that peer, opening the connection if there is none yet.
+ * If the send fails on a connection that was reused before any of it was written, the connection is re-opened and the send is tried once
+ * more. A send that failed part way is not tried again, the peer would get the part that made it twice. The pool mutex is only
+ * held to look the connection up and to record the outcome, so a slow connect doesn't hold up sends to other peers; callers must not send
+ * to the same peer from two threads at once
+ *
+ * @param pool Pointer to the pool
+ * @param peer_id Id of the peer to send to, PEER_ID_SIZE bytes
+ * @param addr Address of the peer
+ * @param addr_len Length of addr in bytes
+ * @param buff The bytes to send
+ * @return 1 if there was an error, 0 if sent successfully
+ */
+int pool_send(ConnPool *pool, char *peer_id, struct sockaddr *addr, socklen_t addr_len, Buffer *buff);
+/**
+ * Sends several buffers of bytes to a peer in order with a single vectored write, otherwise behaves like pool_send
+ *
+ * @param pool Pointer to the pool
+ * @param peer_id Id of the peer to send to, PEER_ID_SIZE bytes
+ * @param addr Address of the peer
+ * @param addr_len Length of addr in bytes
+ * @param buffs Array of pointers to the buffers to send
+ * @param count Number of buffers in buffs
+ * @return 1 if there was an error, 0 if sent successfully
+ */
+int pool_sendv(ConnPool *pool, char *peer_id, struct sockaddr *addr, socklen_t addr_len, Buffer **buffs, int count);
+/**
+ * Sends buffers to several different peers, submitted all at once when the pool has an io_uring, otherwise with non-blocking connects and
+ * writes to up to max_inflight peers at a time, so the send takes about as long as the slowest peer rather than the sum of all of them.
+ * Every send is tried once more on a fresh connection like pool_sendv does, unless it is pinned to a connection
+ *
+ * @param pool Pointer to the pool
+ * @param sends Array of the sends, each to a different peer, the err, written and conn_id fields of every send are set
+ * @param n Number of sends
+ */
+void pool_sendv_all(ConnPool *pool, PoolSend *sends, int n);
+/**
+ * Makes the pool submit its sends through an io_uring instance
+ *
+ * @param pool Pointer to the pool
+ * @return 1 if io_uring is not available (not built in or not supported by the kernel), 0 otherwise
+ */
+int pool_enable_uring(ConnPool *pool);
+/**
+ * Closes the pooled connection to a peer if there is one
+ *
+ * @param pool Pointer to the pool
+ * @param peer_id Id of the peer, PEER_ID_SIZE bytes
+ */
+void pool_close(ConnPool *pool, char *peer_id);
+/**
+ * Closes all connections that have not been used for longer than the idle timeout of the pool
+ *
+ * @param pool Pointer to the pool
+ */
+void pool_evict_idle(ConnPool *pool);
+
+#endif //DISTMSG_POOL_H
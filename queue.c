@@ -0,0 +1,138 @@
+/**
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Implementation of queue.h
+ */
+#include "queue.h"
+
+#include <stdlib.h>
+
+Queue *new_queue(unsigned int capacity, sem_t *ready) {
+    Queue *q;
+    unsigned long long size, i;
+
+    size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    q = malloc(sizeof(Queue));
+    q->cells = malloc(sizeof(QueueCell) * size);
+    for (i = 0; i < size; i++) { /* every cell is free to be filled the first time around the ring */
+        q->cells[i].seq = i;
+        q->cells[i].value = NULL;
+    }
+    q->mask = size - 1;
+    q->tail = 0;
+    q->head = 0;
+    q->overflowed = 0;
+    q->overflow = new_list();
+    pthread_mutex_init(&q->overflow_mutex, NULL);
+    q->ready = ready;
+
+    return q;
+}
+
+void free_queue(Queue *q) {
+    pthread_mutex_destroy(&q->overflow_mutex);
+    free_list(q->overflow);
+    free(q->cells);
+    free(q);
+}
+
+/**
+ * Claims a free cell of the ring and fills it with a value
+ *
+ * @param q Pointer to the queue
+ * @param value Pointer to the value
+ * @return 1 if the ring is full, 0 otherwise
+ */
+int queue_ring_push(Queue *q, void *value) {
+    QueueCell *cell;
+    unsigned long long pos, seq;
+    long long diff;
+
+    pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    while (1) {
+        cell = &q->cells[pos & q->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        diff = (long long) seq - (long long) pos;
+        if (diff == 0) { /* the cell is free, claim it by moving the tail past it */
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) { /* the cell still holds the value pushed one lap ago */
+            return 1;
+        } else { /* another pusher claimed the cell first */
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->value = value;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE); /* hands the cell to the popper of this position */
+    return 0;
+}
+
+/**
+ * Claims a filled cell of the ring and empties it
+ *
+ * @param q Pointer to the queue
+ * @return Pointer to the value, or NULL if the ring is empty
+ */
+void *queue_ring_pop(Queue *q) {
+    QueueCell *cell;
+    unsigned long long pos, seq;
+    long long diff;
+    void *value;
+
+    pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    while (1) {
+        cell = &q->cells[pos & q->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        diff = (long long) seq - (long long) (pos + 1);
+        if (diff == 0) { /* the cell is filled, claim it by moving the head past it */
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) { /* the pusher of this position didn't fill the cell yet */
+            return NULL;
+        } else { /* another popper claimed the cell first */
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    value = cell->value;
+    __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE); /* frees the cell for the pusher one lap ahead */
+    return value;
+}
+
+void queue_push(Queue *q, void *value) {
+    /* once values overflow, newer ones follow them into the overflow list until it drains so the order is kept */
+    if (__atomic_load_n(&q->overflowed, __ATOMIC_ACQUIRE) > 0 || queue_ring_push(q, value)) {
+        pthread_mutex_lock(&q->overflow_mutex);
+        list_push(q->overflow, value);
+        __atomic_add_fetch(&q->overflowed, 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&q->overflow_mutex);
+    }
+
+    if (q->ready != NULL) {
+        sem_post(q->ready);
+    }
+}
+
+void *queue_pop(Queue *q) {
+    void *value;
+
+    value = queue_ring_pop(q);
+    if (value == NULL && __atomic_load_n(&q->overflowed, __ATOMIC_ACQUIRE) > 0) { /* the ring drained, the overflow holds the newer values */
+        pthread_mutex_lock(&q->overflow_mutex);
+        value = list_poplast(q->overflow);
+        if (value != NULL) {
+            __atomic_sub_fetch(&q->overflowed, 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&q->overflow_mutex);
+    }
+
+    return value;
+}
@@ -0,0 +1,76 @@
+/**
+ * Concurrent queue
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * A first in first out queue which any number of threads may push into and pop from at the same time without taking a lock. Values are kept
+ * in a bounded ring of cells, each cell carries a sequence number which tells pushers and poppers whether it is theirs to fill or empty,
+ * so no node is allocated per value. If the ring fills up values wait in an overflow list under a mutex until it drains, so a push never
+ * fails and never blocks. Consumers sleep on a semaphore which is posted once for every value pushed, it may be shared by several queues
+ */
+
+#ifndef DISTMSG_QUEUE_H
+#define DISTMSG_QUEUE_H
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "list.h"
+
+#define QUEUE_CACHE_LINE 64 /* the positions of pushers and poppers are kept this far apart so they don't share a cache line */
+
+/**
+ * Holds a single value in the ring
+ */
+typedef struct {
+    unsigned long long seq; /* position the cell is filled at next if equal to it, position + 1 once filled and waiting to be popped */
+    void *value;
+} QueueCell;
+
+/**
+ * Holds the entire queue
+ */
+typedef struct {
+    QueueCell *cells; /* the ring */
+    unsigned long long mask; /* number of cells - 1, the number of cells is a power of 2 */
+    char pad0[QUEUE_CACHE_LINE];
+    unsigned long long tail; /* position of the next push */
+    char pad1[QUEUE_CACHE_LINE];
+    unsigned long long head; /* position of the next pop */
+    char pad2[QUEUE_CACHE_LINE];
+    int overflowed; /* number of values in overflow */
+    List *overflow; /* values pushed while the ring was full, newest at the top */
+    pthread_mutex_t overflow_mutex;
+    sem_t *ready; /* posted once for every value pushed, NULL if consumers don't wait on the queue */
+} Queue;
+
+/**
+ * Creates a new empty queue
+ *
+ * @param capacity Number of values the ring holds, rounded up to a power of 2
+ * @param ready Pointer to the semaphore consumers wait on, or NULL
+ * @return Pointer to the new queue
+ */
+Queue *new_queue(unsigned int capacity, sem_t *ready);
+/**
+ * Frees a given queue except for the values still in it
+ *
+ * @param q Pointer to the queue
+ */
+void free_queue(Queue *q);
+/**
+ * Pushes a value to the back of the queue
+ *
+ * @param q Pointer to the queue
+ * @param value Pointer to the value
+ */
+void queue_push(Queue *q, void *value);
+/**
+ * Removes the value at the front of the queue and returns it, never waits
+ *
+ * @param q Pointer to the queue
+ * @return Pointer to the value removed, or NULL if the queue is empty
+ */
+void *queue_pop(Queue *q);
+
+#endif //DISTMSG_QUEUE_H
@@ -0,0 +1,89 @@
+/**
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Implementation of stream.h
+ */
+#include "stream.h"
+#include "table.h"
+
+StreamId stream_id_of(Message *msg) {
+    Buffer origin;
+
+    origin.data = msg->from_peer;
+    origin.len = PEER_ID_SIZE;
+    return (table_hash(origin) & 0xFFFFFFFF00000000ULL) | (msg->seq & 0xFFFFFFFFULL);
+}
+
+/**
+ * Creates a frame holding a frame header and a stream id, followed by some or none of the rest of the payload
+ *
+ * @param type Type of the frame
+ * @param id Id of the stream
+ * @param payload_len Length of the whole payload of the frame, the stream id included
+ * @param extra Number of bytes to allocate after the stream id
+ * @return Pointer to the new frame
+ */
+SharedFrame *stream_frame(unsigned char type, StreamId id, Uint payload_len, Uint extra) {
+    SharedFrame *f;
+
+    f = new_shared_frame(NULL, FRAME_HEADER_SIZE + STREAM_ID_SIZE + extra);
+    frame_write_header(f->buff.data, type, payload_len);
+    memcpy((char *) f->buff.data + FRAME_HEADER_SIZE, &id, STREAM_ID_SIZE);
+
+    return f;
+}
+
+SharedFrame **stream_split(SharedFrame *msg_frame, StreamId id, Uint chunk_size, int *count) {
+    SharedFrame **frames, *begin;
+    char *msg;
+    Uint content_len, offset, len;
+    int n_chunks, i;
+
+    msg = (char *) msg_frame->buff.data + FRAME_HEADER_SIZE;
+    content_len = msg_frame->buff.len - FRAME_HEADER_SIZE - MSG_HEADER_SIZE;
+    n_chunks = (content_len + chunk_size - 1) / chunk_size;
+    frames = malloc(sizeof(SharedFrame *) * (1 + 2 * n_chunks));
+
+    begin = stream_frame(FRAME_STREAM_BEGIN, id, STREAM_ID_SIZE + MSG_HEADER_SIZE, MSG_HEADER_SIZE);
+    memcpy((char *) begin->buff.data + FRAME_HEADER_SIZE + STREAM_ID_SIZE, msg, MSG_HEADER_SIZE);
+    frames[0] = begin;
+
+    *count = 1;
+    for (i = 0, offset = 0; i < n_chunks; i++, offset += len) {
+        len = content_len - offset < chunk_size ? content_len - offset : chunk_size;
+        frames[(*count)++] = stream_frame(FRAME_STREAM_CHUNK, id, STREAM_ID_SIZE + len, 0);
+        frames[(*count)++] = frame_slice(msg_frame, FRAME_HEADER_SIZE + MSG_HEADER_SIZE + offset, len); /* written right after its header */
+    }
+
+    return frames;
+}
+
+SharedFrame *stream_abort_frame(StreamId id) {
+    return stream_frame(FRAME_STREAM_ABORT, id, STREAM_ID_SIZE, 0);
+}
+
+int stream_read_id(char *payload, Uint len, StreamId *id) {
+    if (len < STREAM_ID_SIZE) {
+        return 1;
+    }
+    memcpy(id, payload, STREAM_ID_SIZE);
+    return 0;
+}
+
+Message *stream_read_begin(char *payload, Uint len) {
+    Message *msg;
+
+    if (len != STREAM_ID_SIZE + MSG_HEADER_SIZE) {
+        return NULL;
+    }
+    payload += STREAM_ID_SIZE;
+
+    msg = malloc(sizeof(Message));
+    deserialize_msg_header(payload, msg);
+    msg->content.data = NULL;
+    memset(msg->through_peer, 0, PEER_ID_SIZE);
+    msg->wire = NULL;
+
+    return msg;
+}
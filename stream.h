@@ -0,0 +1,71 @@
+/**
+ * Streamed messages
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * A message whose content is too large to hold in one frame comfortably is sent as a stream: a FRAME_STREAM_BEGIN frame with the header of
+ * the message followed by FRAME_STREAM_CHUNK frames carrying its content in order. Every frame of a stream starts with the id of the stream so
+ * the chunks of several streams may be interleaved with each other and with other frames on one connection. Relays forward every chunk to
+ * the next hops as soon as it arrives instead of waiting for the whole message
+ */
+
+#ifndef DISTMSG_STREAM_H
+#define DISTMSG_STREAM_H
+
+#include "util.h"
+#include "message.h"
+#include "frame.h"
+
+#define STREAM_ID_SIZE 8 /* bytes of the stream id at the start of the payload of every stream frame */
+
+typedef unsigned long long StreamId;
+
+/**
+ * Derives the id of the stream of a message from its origin and its number. Relays forward stream frames under the id they arrived with,
+ * so streams from many origins share the ids on a connection. The high half of the id is the hash of the origin id and the low half is the
+ * low half of the number of the message, so two streams open on one connection at the same time only share an id if the ids of their
+ * origins hash alike or one origin numbered 2^32 messages while the other stream was open
+ *
+ * @param msg Pointer to the message, numbered by its origin
+ * @return The id
+ */
+StreamId stream_id_of(Message *msg);
+/**
+ * Splits a framed message into the frames of a stream, the chunks point into the bytes of the message frame instead of copying them.
+ * Each chunk is made of two frames, the header and the stream id in a small frame of its own followed by a slice of the content, so the
+ * two must be queued with nothing between them, see batcher_add_many
+ *
+ * @param msg_frame Pointer to the FRAME_MSG frame of the message
+ * @param id Id of the stream
+ * @param chunk_size Most content bytes in one chunk
+ * @param count Pointer to an int which is set to the number of frames returned
+ * @return Array of pointers to the frames in the order they are sent, the caller holds a reference to each and frees the array
+ */
+SharedFrame **stream_split(SharedFrame *msg_frame, StreamId id, Uint chunk_size, int *count);
+/**
+ * Creates the frame which tells the receiver of a stream that the rest of it will never come
+ *
+ * @param id Id of the stream
+ * @return Pointer to the new frame
+ */
+SharedFrame *stream_abort_frame(StreamId id);
+/**
+ * Reads the stream id at the start of the payload of a stream frame
+ *
+ * @param payload The payload of the frame
+ * @param len Length of the payload
+ * @param id Pointer to the id to read into
+ * @return 1 if the payload is too short to hold a stream id, 0 otherwise
+ */
+int stream_read_id(char *payload, Uint len, StreamId *id);
+/**
+ * Decodes the header of the streamed message carried by the payload of a FRAME_STREAM_BEGIN frame
+ *
+ * @param payload The payload of the frame
+ * @param len Length of the payload
+ * @return Pointer to a new message whose content length is the length of the whole streamed content and whose content data is NULL,
+ * or NULL if the payload doesn't hold a message header
+ */
+Message *stream_read_begin(char *payload, Uint len);
+
+#endif //DISTMSG_STREAM_H
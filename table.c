@@ -12,150 +12,327 @@
 #include <string.h>
 
 Table *new_table() {
-    int i;
     Table *t;
+
     t = malloc(sizeof(Table)); /* allocate space for the table */
     t->size = 0;
-
-    for (i = 0; i < TABLE_SIZE; i++) {/* initialize all pointers in the table to NULL */
-        t->arr[i] = NULL;
-    }
+    t->slots = calloc(TABLE_MIN_SIZE, sizeof(TableNode)); /* every slot starts empty */
+    t->mask = TABLE_MIN_SIZE - 1;
+    t->old = NULL;
+    t->old_mask = 0;
+    t->moved = 0;
 
     return t;
 }
 
-void free_table(Table *t) {
-    int i;
-    TableNode *n, *tmp;
-    for (i = 0; i < TABLE_SIZE; i++) { /* Iterate over all cells in the array */
-        n = t->arr[i];
-        while (n != NULL) { /* Iterate over the entire chain in the cell and free all nodes*/
-            tmp = n->next;
-            free(n->key.data);
-            free(n);
-            n = tmp;
+/**
+ * Frees the keys of the pairs in an array of slots and the array itself
+ *
+ * @param slots The array
+ * @param mask Number of slots - 1
+ */
+void table_free_slots(TableNode *slots, Uint mask) {
+    Uint i;
+
+    for (i = 0; i <= mask; i++) {
+        if (slots[i].dist > 0 && !slots[i].gone && slots[i].key.len > TABLE_INLINE_KEY) {
+            free(slots[i].key.data);
         }
     }
+    free(slots);
+}
+
+void free_table(Table *t) {
+    table_free_slots(t->slots, t->mask);
+    if (t->old != NULL) {
+        table_free_slots(t->old, t->old_mask);
+    }
     free(t);/* free table */
 }
 
-int table_hash(Table *mp, Buffer key) {
-    int bucketIndex; /* index calculated */
-    int c;
-    char *key_data;
-    unsigned long hash;
+/**
+ * Rotates the bits of a word to the left
+ *
+ * @param x The word
+ * @param r Number of bits, between 1 and 63
+ * @return The rotated word
+ */
+unsigned long long table_rotl(unsigned long long x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
 
-    hash = START_HASH;
-    key_data = (char*)key.data;
+/**
+ * Scrambles a word of the key before it's added to the hash
+ *
+ * @param k The word
+ * @return The scrambled word
+ */
+unsigned long long table_hash_word(unsigned long long k) {
+    k *= TABLE_HASH_C1;
+    k = table_rotl(k, 31);
+    return k * TABLE_HASH_C2;
+}
+
+unsigned long long table_hash(Buffer key) {
+    unsigned long long hash, word;
+    unsigned char *key_data;
+    Uint i;
 
-    while ((c = (int)(*key_data++) )) { /* iterate over all bytes in the buffer */
-        hash = ((hash << HASH_SHIFT) + hash) + c; /* hash * 33 + c */
+    key_data = (unsigned char *) key.data;
+    hash = TABLE_HASH_SEED ^ ((unsigned long long) key.len * TABLE_HASH_C2); /* keys that are prefixes of each other hash apart */
+
+    for (i = 0; i + 8 <= key.len; i += 8) { /* whole words, copied out since keys need not be aligned */
+        memcpy(&word, key_data + i, 8);
+        hash ^= table_hash_word(word);
+        hash = table_rotl(hash, 27) * 5 + 0x52DCE729;
+    }
+    if (i < key.len) { /* the last few bytes make up one more word */
+        word = 0;
+        memcpy(&word, key_data + i, key.len - i);
+        hash ^= table_hash_word(word);
     }
-    bucketIndex = hash % TABLE_SIZE; /* make sure hash in within limits of table index*/
 
-    return bucketIndex;
+    /* final mix so every bit of the key affects every bit of the hash */
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
 }
 
-void table_insert(Table *t, Buffer key, Buffer value) {
-    int bucketIndex;
-    TableNode *newNode;
-    /* Allocate space for a new table node, copy the key buffer and set the pointer of the value to the value pointer provided*/
-    newNode = malloc(sizeof(TableNode));
-    newNode->key.len = key.len;
-    newNode->key.data = malloc(key.len);
-    memcpy(newNode->key.data, key.data, key.len);
-    newNode->value = value;
-    bucketIndex = table_hash(t, key);
-    newNode->next = NULL;
-
-    if (t->arr[bucketIndex] == NULL) { /* if cell is free set it to new node */
-        t->arr[bucketIndex] = newNode;
-
-    } else if (buffer_cmp(newNode->key, t->arr[bucketIndex]->key) !=0) { /* else push new node to the top of the chain */
-        newNode->next = t->arr[bucketIndex];
-        t->arr[bucketIndex] = newNode;
+/**
+ * Checks whether two keys are equal, a word at a time
+ *
+ * @param a Buffer containing one key
+ * @param b Buffer containing the other
+ * @return 1 if the keys have the same length and bytes, 0 otherwise
+ */
+int table_key_eq(Buffer a, Buffer b) {
+    unsigned long long wa, wb, diff;
+    Uint i;
+
+    if (a.len != b.len) {
+        return 0;
     }
-    t->size ++; /* keep count of the number of key/value pairs in the table */
+    diff = 0;
+    for (i = 0; i + 8 <= a.len; i += 8) { /* no early exit, keys that get this far almost always match */
+        memcpy(&wa, (char *) a.data + i, 8);
+        memcpy(&wb, (char *) b.data + i, 8);
+        diff |= wa ^ wb;
+    }
+    if (i < a.len) {
+        return diff == 0 && memcmp((char *) a.data + i, (char *) b.data + i, a.len - i) == 0;
+    }
+    return diff == 0;
 }
 
-void table_delete(Table *t, Buffer key) {
-    int bucketIndex;
-    TableNode *prevNode, *currNode;
+/**
+ * Copies the pair in one slot into another, a key stored inline is pointed at its new place
+ *
+ * @param dst Pointer to the slot to copy into
+ * @param src Pointer to the slot to copy from
+ */
+void table_node_copy(TableNode *dst, TableNode *src) {
+    *dst = *src;
+    if (dst->key.len <= TABLE_INLINE_KEY) {
+        dst->key.data = dst->inline_key;
+    }
+}
 
-    prevNode = NULL;
-    bucketIndex = table_hash(t, key);/* calculate hash from key */
-    currNode = t->arr[bucketIndex];
+/**
+ * Finds the slot of a key in an array of slots
+ *
+ * @param slots The array
+ * @param mask Number of slots - 1
+ * @param key Buffer containing the key
+ * @param hash Hash of the key
+ * @return Pointer to the slot or NULL if the key is not in the array
+ */
+TableNode *table_find(TableNode *slots, Uint mask, Buffer key, unsigned long long hash) {
+    Uint i, dist;
+
+    i = hash & mask;
+    for (dist = 1; slots[i].dist >= dist; dist++) { /* a pair closer to its home than the key would be to its own means the key isn't here */
+        if (slots[i].hash == hash && !slots[i].gone && table_key_eq(slots[i].key, key)) { /* the key is only compared when the whole hash matches */
+            return &slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
 
-    while (currNode != NULL) { /* if the cell in the table is occupied, keep looping until the node in the cell's chain has the same key as the input key or until the end of the chain */
-        if (buffer_cmp(key, currNode->key) == 0) { /* if we find a node in the chain that has the same key, delete it from the table be either disconneting it from the chain
- * or setting the cell in the array to NULL */
-            if (currNode == t->arr[bucketIndex]) { /* If node is head of list, replace head of list with the next node*/
-                t->arr[bucketIndex] = currNode->next;
+/**
+ * Places a pair into an array of slots, pairs closer to their home slot make way for it and move further along in turn
+ *
+ * @param slots The array, it must have an empty slot
+ * @param mask Number of slots - 1
+ * @param node Pointer to the pair to place with its hash set, its contents are used up
+ */
+void table_place(TableNode *slots, Uint mask, TableNode *node) {
+    TableNode carry, tmp;
+    Uint i;
+
+    table_node_copy(&carry, node);
+    carry.dist = 1;
+    carry.gone = 0;
+    i = carry.hash & mask;
+    while (slots[i].dist > 0) {
+        if (slots[i].dist < carry.dist) { /* the pair here is richer, it gives up its slot and is carried on instead */
+            table_node_copy(&tmp, &slots[i]);
+            table_node_copy(&slots[i], &carry);
+            table_node_copy(&carry, &tmp);
+        }
+        i = (i + 1) & mask;
+        carry.dist++;
+    }
+    table_node_copy(&slots[i], &carry);
+}
 
-            } else {
-                prevNode->next = currNode->next; /*otherwise, connect the previouse node to the next node*/
-            }
-            /* decrease node count and free memory */
-            t->size --;
-            free(currNode->key.data);
-            free(currNode);
-            break;
+/**
+ * Moves a few pairs from the old array to the new one, the old array is freed once it's empty
+ *
+ * @param t Pointer to the table
+ * @param count Number of slots of the old array to look at
+ */
+void table_move_some(Table *t, Uint count) {
+    TableNode *slot;
+
+    while (t->old != NULL && count-- > 0) {
+        slot = &t->old[t->moved++];
+        if (slot->dist > 0 && !slot->gone) {
+            table_place(t->slots, t->mask, slot); /* the hash is kept in the slot, the key isn't read again */
+            slot->gone = 1; /* the key now belongs to the new array, the slot is kept taken so probes in the old array still reach past it */
+        }
+        if (t->moved > t->old_mask) { /* every pair was moved */
+            free(t->old);
+            t->old = NULL;
         }
-        /* keep track of previous node and iterate through all nodes */
-        prevNode = currNode;
-        currNode = currNode->next;
     }
 }
 
-Buffer *table_search(Table *t, Buffer key) {
-    int bucketIndex;
-    TableNode *bucketHead;
+/**
+ * Makes room for one more pair, once the table is three quarters full a twice as large array takes over and the pairs move into it gradually
+ *
+ * @param t Pointer to the table
+ */
+void table_grow(Table *t) {
+    if ((t->size + 1) * 4 <= (t->mask + 1) * 3) {
+        return;
+    }
+    table_move_some(t, t->old_mask + 1); /* still growing from the last time, which is rare since every change moves several slots */
+
+    t->old = t->slots;
+    t->old_mask = t->mask;
+    t->moved = 0;
+    t->mask = t->mask * 2 + 1;
+    t->slots = calloc(t->mask + 1, sizeof(TableNode));
+}
+
+void table_insert(Table *t, Buffer key, Buffer value) {
+    TableNode node, *found;
+    unsigned long long hash;
+
+    hash = table_hash(key);
+    found = table_find(t->slots, t->mask, key, hash);
+    if (found == NULL && t->old != NULL) {
+        found = table_find(t->old, t->old_mask, key, hash);
+    }
+    if (found != NULL) { /* the key is already in the table, only the value changes */
+        found->value = value;
+        return;
+    }
+
+    table_grow(t);
+    node.key.len = key.len;
+    node.key.data = key.len <= TABLE_INLINE_KEY ? node.inline_key : malloc(key.len); /* copy the key, short keys are kept in the slot */
+    memcpy(node.key.data, key.data, key.len);
+    node.value = value;
+    node.hash = hash;
+    table_place(t->slots, t->mask, &node);
+    t->size ++; /* keep count of the number of key/value pairs in the table */
 
-    bucketIndex = table_hash(t, key); /* calculate hash from key */
-    bucketHead = t->arr[bucketIndex];
+    table_move_some(t, TABLE_MOVE_STEP);
+}
 
-    while (bucketHead != NULL) { /* if cell node empty, iterate through chain at cell to check if a node in the chain has identical key*/
-        if (buffer_cmp(bucketHead->key, key) == 0) {
-            return &bucketHead->value; /* if a node with an identical key is found, return it's value */
+void table_delete(Table *t, Buffer key) {
+    TableNode *found;
+    Uint i, next;
+    unsigned long long hash;
+
+    hash = table_hash(key);/* calculate hash from key */
+    found = NULL;
+    if (t->old != NULL) {
+        found = table_find(t->old, t->old_mask, key, hash);
+        if (found != NULL) { /* pairs don't shift in the old array while it is being moved out of, the slot stays taken */
+            if (found->key.len > TABLE_INLINE_KEY) {
+                free(found->key.data);
+            }
+            found->gone = 1;
         }
+    }
+    if (found == NULL) {
+        found = table_find(t->slots, t->mask, key, hash);
+        if (found == NULL) {
+            return;
+        }
+        if (found->key.len > TABLE_INLINE_KEY) {
+            free(found->key.data);
+        }
+        /* shift the pairs after it back by one slot until one is in its home slot or the slot is empty, so no probe ever stops early */
+        i = found - t->slots;
+        next = (i + 1) & t->mask;
+        while (t->slots[next].dist > 1) {
+            table_node_copy(&t->slots[i], &t->slots[next]);
+            t->slots[i].dist--;
+            i = next;
+            next = (i + 1) & t->mask;
+        }
+        t->slots[i].dist = 0;
+    }
+    t->size --;
 
-        bucketHead = bucketHead->next;
+    table_move_some(t, TABLE_MOVE_STEP);
+}
+
+Buffer *table_search(Table *t, Buffer key) {
+    TableNode *found;
+    unsigned long long hash;
+
+    hash = table_hash(key); /* calculate hash from key */
+    found = table_find(t->slots, t->mask, key, hash);
+    if (found == NULL && t->old != NULL) { /* not moved to the new array yet */
+        found = table_find(t->old, t->old_mask, key, hash);
     }
-    /* otherwise, return  null */
-    return NULL;
+
+    return found != NULL ? &found->value : NULL;
 }
 
 TableIter* table_iter_new(Table *mp) {
     TableIter *it;
     it = malloc(sizeof(TableIter)); /*allocate memory for array index, table and node pointers */
-    it->i = -1; /* set to -1 because upon first call of table_iter_next we increase index by 1 at the beginning of the function */
+    it->i = 0;
     it->curr = NULL;
     it->mp = mp;
     return it;
 }
 
 int table_iter_next(TableIter *it) {
-    if (it->curr == NULL) { /* If new iterator or reached end of cell */
-        it->i++;/* increase index counter */
-        while (it->i < TABLE_SIZE && it->mp->arr[it->i] == NULL) it->i++; /* if next cell is empty, keep iterating through cells until a non empty one is found or we reach end of array */
-        if (it->i >= TABLE_SIZE) { /* if we reach end of array return NULL since it is also the end of the table */
-            return 0;
-        }
-        it->curr = it->mp->arr[it->i]; /* otherwise, set iterator node pointer to the first node in the chain at cell i */
-
-        if (it->curr == NULL) {
-            return 0;
-        }
-
-    }else {
-        /* otherwise, we are iterating through a chain therefore we simple move the node pointer to the next one in the chain */
-        it->curr = it->curr->next;
-        if (it->curr == NULL) {
-            return table_iter_next(it);
+    Uint n_old;
+    TableNode *slot;
+
+    n_old = it->mp->old != NULL ? it->mp->old_mask + 1 : 0;
+    while (it->i < n_old + it->mp->mask + 1) { /* the slots of the old array first, then the slots of the new one */
+        slot = it->i < n_old ? &it->mp->old[it->i] : &it->mp->slots[it->i - n_old];
+        it->i++;
+        if (slot->dist > 0 && !slot->gone) {
+            it->curr = slot;
+            return 1;
         }
     }
-    /* If not returned 0 then we have iterated so we return 1 */
-    return 1;
+    it->curr = NULL;
+    return 0;
 }
 
 Buffer *serialize_table(Table *mp) {
@@ -216,7 +393,6 @@ int deserialize_table_iter_next(DeserializeTableIter *it) {
         it->curr->key.data = NULL;
         it->curr->value.len = 0;
         it->curr->value.data = NULL;
-        it->curr->next = NULL;
     }
     /* if we have data from previouse node, free it*/
     if (it->curr->key.data != NULL) {
@@ -1,44 +1,56 @@
 /**
- * Hashtable implementation with chaining
+ * Hashtable implementation with open addressing
  * Author: Amit Hendin
  * Date: 13/8/2023
  *
- * A standard and simple implementation of a hashtable data structure using chaining to resolve conflicts and with some extra features
+ * A hashtable data structure with some extra features. Pairs are kept in a single array of slots and a pair that collides takes the next
+ * free slot (robin hood hashing: a pair far from its home slot takes the place of one closer to its own, so every lookup probes only a few
+ * neighboring slots). Short keys are stored inside the slot itself so most pairs cost no allocation at all. The array doubles once it's
+ * three quarters full, the pairs are moved over a few at a time by the inserts and deletes that follow, so no single insert pays for moving
+ * the whole table. Searching and iterating never change the table, so any number of threads may read a table nobody writes to
  */
-
 #ifndef DISTMSG_TABLE_H
 #define DISTMSG_TABLE_H
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
 #include "util.h"
 
-#define TABLE_SIZE 100 /* number of cells in the hash table array */
-#define START_HASH 5321 /* parameter for the hash function */
-#define HASH_SHIFT 5 /* another parameter */
+#define TABLE_MIN_SIZE 16 /* number of slots of a new table, a power of 2 */
+#define TABLE_INLINE_KEY 24 /* keys up to this many bytes are stored inside the slot */
+#define TABLE_MOVE_STEP 8 /* slots of the old array moved to the new one by every insert or delete while the table grows */
+#define TABLE_HASH_SEED 0x9E3779B97F4A7C15ULL /* parameters of the hash function */
+#define TABLE_HASH_C1 0x87C37B91114253D5ULL
+#define TABLE_HASH_C2 0x4CF5AD432745937FULL
 
 /**
- * Holds a node in the hash table which contains a single key value pair and pointer to the next key in the chain
+ * Holds a single slot of the table, which is either empty or contains a single key value pair
  */
 typedef struct node {
-    Buffer key;
+    unsigned long long hash; /* hash of the key, compared before the key itself and reused when the pair moves to a larger array */
+    Buffer key; /* points to inline_key if the key is short enough, otherwise to a copy of the key of its own */
     Buffer value;
-    struct node *next;
+    Uint dist; /* 0 if the slot is empty, otherwise 1 + how many slots the pair is past its home slot */
+    Uint gone; /* 1 if the pair was moved to the new array or deleted while the table grows, the slot still counts as taken when probing */
+    char inline_key[TABLE_INLINE_KEY];
 } TableNode;
 /**
  * Holds the entire table basically
  */
 typedef struct table {
-    unsigned int size;
-    TableNode *arr[TABLE_SIZE];
+    unsigned int size; /* number of pairs */
+    TableNode *slots;
+    Uint mask; /* number of slots - 1 */
+    TableNode *old; /* the array the table is growing out of, NULL unless it is growing */
+    Uint old_mask; /* number of slots of old - 1 */
+    Uint moved; /* slots of old that were moved so far */
 } Table;
 /**
  * Holds the data necessary to iterate over the table completely
  */
 typedef struct {
-    int i;
+    Uint i; /* index of the next slot to look at, the slots of old come first */
     TableNode *curr;
     Table *mp;
 } TableIter;
@@ -63,15 +75,15 @@ Table *new_table();
  */
 void free_table(Table *mp);
 /**
- * The hash function used to calculate the array index from a provided key
+ * The hash function used to pick the home slot of a key. The key is read 8 bytes at a time and every byte and the length count, so
+ * binary keys which differ in a single byte, zeros included, get unrelated hashes. All 64 bits are well mixed, callers may use any of them
  *
- * @param mp Pointer to the table
  * @param key Buffer which contains the key
- * @return The index in the array which calculated from the key
+ * @return The hash of the key
  */
-int table_hash(Table *mp, Buffer key);
+unsigned long long table_hash(Buffer key);
 /**
- * Insert a key and value to a table
+ * Insert a key and value to a table, the key is copied. If the key is already in the table its value is replaced
  *
  * @param mp Pointer to the table
  * @param key Buffer which contains the key
@@ -90,7 +102,7 @@ void table_delete(Table *mp, Buffer key);
  *
  * @param mp Pointer to the table
  * @param key Buffer containing the key
- * @return A pointer to the buffer containing the value paired to the key
+ * @return A pointer to the buffer containing the value paired to the key, valid until the table is next changed, or NULL if the key is not in the table
  */
 Buffer *table_search(Table *mp, Buffer key);
 /**
@@ -101,7 +113,7 @@ Buffer *table_search(Table *mp, Buffer key);
  */
 TableIter* table_iter_new(Table *mp);
 /**
- * Move the give table iterator to the next key/value pair in the table
+ * Move the give table iterator to the next key/value pair in the table, the table must not be changed while it is iterated over
  *
  * @param it Pointer to the iterator
  * @return 1 if there is another key/value pair in the table, otherwise 0
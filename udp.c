@@ -0,0 +1,100 @@
+/**
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Implementation of udp.h
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "udp.h"
+
+int udp_open(int port) {
+    int fd, flags;
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    flags = fcntl(fd, F_GETFL, 0);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+UdpReceiver *new_udp_receiver() {
+    UdpReceiver *r;
+    int i;
+
+    r = malloc(sizeof(UdpReceiver));
+    r->bufs = malloc((size_t) UDP_BATCH * UDP_MAX_DATAGRAM);
+    memset(r->msgs, 0, sizeof(r->msgs));
+    for (i = 0; i < UDP_BATCH; i++) { /* every message header points at its own buffer, set up once and reused for every receive */
+        r->iovs[i].iov_base = r->bufs + (size_t) i * UDP_MAX_DATAGRAM;
+        r->iovs[i].iov_len = UDP_MAX_DATAGRAM;
+        r->msgs[i].msg_hdr.msg_iov = &r->iovs[i];
+        r->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return r;
+}
+
+void free_udp_receiver(UdpReceiver *r) {
+    free(r->bufs);
+    free(r);
+}
+
+int udp_receive(int fd, UdpReceiver *r) {
+    int n;
+
+    do {
+        n = recvmmsg(fd, r->msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
+
+    return n < 0 ? 0 : n;
+}
+
+char *udp_datagram(UdpReceiver *r, int i) {
+    return r->bufs + (size_t) i * UDP_MAX_DATAGRAM;
+}
+
+int udp_send_all(int fd, UdpSend *sends, int n) {
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    int first, count, i, sent;
+
+    first = 0;
+    while (first < n) {
+        count = n - first < UDP_BATCH ? n - first : UDP_BATCH;
+        memset(msgs, 0, sizeof(struct mmsghdr) * count);
+        for (i = 0; i < count; i++) {
+            iovs[i].iov_base = sends[first + i].frame->data;
+            iovs[i].iov_len = sends[first + i].frame->len;
+            msgs[i].msg_hdr.msg_name = &sends[first + i].to;
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        sent = sendmmsg(fd, msgs, count, 0);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { /* socket buffer is full, datagrams are best effort so the rest are dropped */
+                return first;
+            }
+            first++; /* an error is reported for the first datagram of the call only, skip it and go on with the others */
+            continue;
+        }
+        first += sent;
+    }
+    return first;
+}
@@ -0,0 +1,83 @@
+/**
+ * UDP datagram transport
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Small messages can be sent to peers as UDP datagrams instead of over a TCP connection, one frame per datagram. Datagrams are received and
+ * sent in batches with recvmmsg/sendmmsg so a burst of small messages costs a handful of system calls. Datagrams may get lost, which is fine
+ * since messages are flooded over every path and duplicates are ignored anyway
+ */
+
+#ifndef DISTMSG_UDP_H
+#define DISTMSG_UDP_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "util.h"
+
+#define UDP_BATCH 32 /* most datagrams received or sent with one system call */
+#define UDP_MAX_DATAGRAM 65507 /* largest payload of a UDP datagram over IPv4 */
+
+/**
+ * Holds the buffers datagrams are received into
+ */
+typedef struct {
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    char *bufs; /* UDP_BATCH buffers of UDP_MAX_DATAGRAM bytes */
+} UdpReceiver;
+/**
+ * Holds a single datagram to send
+ */
+typedef struct {
+    struct sockaddr_in to; /* address of the peer */
+    Buffer *frame; /* the framed message to send as the payload of the datagram */
+} UdpSend;
+
+/**
+ * Creates a non-blocking UDP socket bound to a port on all interfaces
+ *
+ * @param port The port number, the same one the peer listener uses for TCP
+ * @return The socket or -1 if there was an error
+ */
+int udp_open(int port);
+/**
+ * Creates the buffers to receive datagrams into
+ *
+ * @return Pointer to the new receiver
+ */
+UdpReceiver *new_udp_receiver();
+/**
+ * Frees a receiver and its buffers
+ *
+ * @param r Pointer to the receiver
+ */
+void free_udp_receiver(UdpReceiver *r);
+/**
+ * Receives up to UDP_BATCH datagrams that are waiting on the socket without blocking
+ *
+ * @param fd The UDP socket
+ * @param r Pointer to the receiver, datagram i is at udp_datagram(r, i) and is r->msgs[i].msg_len bytes long
+ * @return Number of datagrams received, 0 if there are none waiting
+ */
+int udp_receive(int fd, UdpReceiver *r);
+/**
+ * Returns the payload of a datagram received by udp_receive
+ *
+ * @param r Pointer to the receiver
+ * @param i Index of the datagram
+ * @return Pointer to the bytes of the datagram
+ */
+char *udp_datagram(UdpReceiver *r, int i);
+/**
+ * Sends datagrams, UDP_BATCH at a time
+ *
+ * @param fd The UDP socket
+ * @param sends Array of the datagrams to send
+ * @param n Number of datagrams
+ * @return Number of datagrams which were handed to the kernel
+ */
+int udp_send_all(int fd, UdpSend *sends, int n);
+
+#endif //DISTMSG_UDP_H
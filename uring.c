@@ -0,0 +1,143 @@
+/**
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Implementation of uring.h
+ */
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+int uring_init(Uring *ring, unsigned entries) {
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(Uring));
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) {
+        return 1;
+    }
+    ring->features = p.features;
+    ring->sq_entries = p.sq_entries;
+
+    /* map the submission and completion rings, newer kernels put both in a single mapping */
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        close(ring->fd);
+        return 1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(ring->fd);
+            return 1;
+        }
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ring != ring->sq_ring) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        return 1;
+    }
+
+    ring->sq_head = (unsigned *) ((char *) ring->sq_ring + p.sq_off.head);
+    ring->sq_tail = (unsigned *) ((char *) ring->sq_ring + p.sq_off.tail);
+    ring->sq_mask = (unsigned *) ((char *) ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) ((char *) ring->sq_ring + p.sq_off.array);
+    ring->cq_head = (unsigned *) ((char *) ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (unsigned *) ((char *) ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask = (unsigned *) ((char *) ring->cq_ring + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ring + p.cq_off.cqes);
+    ring->sqe_tail = *ring->sq_tail;
+
+    return 0;
+}
+
+void uring_exit(Uring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+    struct io_uring_sqe *sqe;
+    unsigned index;
+
+    while (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) { /* queue is full, hand what we have to the kernel */
+        uring_submit_and_wait(ring, 0, -1);
+    }
+    index = ring->sqe_tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    ring->sqe_tail++; /* the kernel sees the entry only once the shared tail is moved in uring_submit_and_wait */
+
+    return sqe;
+}
+
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr, int timeout) {
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned to_submit, flags;
+    int res;
+
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE); /* publish the filled entries */
+    to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    if (wait_nr > 0 && timeout >= 0 && (ring->features & IORING_FEAT_EXT_ARG)) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (long long) (timeout % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (unsigned long long) (unsigned long) &ts;
+        res = (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } else {
+        res = (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr, flags, NULL, 0);
+    }
+
+    if (res < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+        return -1;
+    }
+    return res < 0 ? 0 : res;
+}
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring) {
+    unsigned head;
+
+    head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(Uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif //HAVE_IO_URING
@@ -0,0 +1,82 @@
+/**
+ * Minimal io_uring wrapper
+ * Author: Amit Hendin
+ * Date: 17/10/2026
+ *
+ * Sets up an io_uring instance directly through the kernel interface and exposes just enough to queue submissions and reap completions,
+ * so sockets can be accepted, read and written with many operations in flight per system call. Only built when HAVE_IO_URING is defined
+ */
+
+#ifndef DISTMSG_URING_H
+#define DISTMSG_URING_H
+
+#ifdef HAVE_IO_URING
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 256 /* number of submission queue entries of a ring */
+
+/**
+ * Holds an io_uring instance and the memory it shares with the kernel
+ */
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned sqe_tail; /* tail of the submission queue including entries that were filled but not submitted yet */
+    unsigned features; /* IORING_FEAT_* flags the kernel supports */
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} Uring;
+
+/**
+ * Creates an io_uring instance
+ *
+ * @param ring Pointer to the struct to initialize
+ * @param entries Number of submission queue entries
+ * @return 1 if there was an error (for example the kernel doesn't support io_uring), 0 otherwise
+ */
+int uring_init(Uring *ring, unsigned entries);
+/**
+ * Destroys an io_uring instance
+ *
+ * @param ring Pointer to the ring
+ */
+void uring_exit(Uring *ring);
+/**
+ * Returns the next free submission queue entry, zeroed, submitting the entries filled so far if the queue is full
+ *
+ * @param ring Pointer to the ring
+ * @return Pointer to the entry to fill in
+ */
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+/**
+ * Submits all filled entries and waits for completions
+ *
+ * @param ring Pointer to the ring
+ * @param wait_nr Number of completions to wait for, 0 to only submit
+ * @param timeout Milliseconds to wait at most, or -1 to wait without a time limit
+ * @return Number of entries submitted, or -1 if there was an error (timing out is not an error)
+ */
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr, int timeout);
+/**
+ * Returns the oldest completion which was not marked as seen yet without waiting
+ *
+ * @param ring Pointer to the ring
+ * @return Pointer to the completion or NULL if there is none
+ */
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+/**
+ * Marks the oldest completion as seen so its slot can be reused by the kernel
+ *
+ * @param ring Pointer to the ring
+ */
+void uring_cqe_seen(Uring *ring);
+
+#endif //HAVE_IO_URING
+
+#endif //DISTMSG_URING_H